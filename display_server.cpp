@@ -0,0 +1,42 @@
+#include <iostream>
+#include <atomic>
+#include <csignal>
+#include <stdexcept>
+
+#include "terminal_graphics.h"
+#include "display_server.h"
+
+
+// Minimal display server: displays the frames submitted by any number of
+// processes via TG::DisplayClient, until interrupted. Usage:
+//
+//     display_server [name]
+//
+// where `name` is the name of the shared memory region for clients to attach
+// to (default: /tg_display).
+
+namespace {
+  std::atomic<bool> stop (false);
+  void handle_signal (int) { stop = true; }
+}
+
+
+int main (int argc, char* argv[])
+{
+  try {
+    const std::string name = argc > 1 ? argv[1] : "/tg_display";
+
+    std::signal (SIGINT, handle_signal);
+    std::signal (SIGTERM, handle_signal);
+
+    TG::DisplayServer server (name);
+    std::cerr << "display server listening on \"" << name << "\"\n";
+    server.run (stop);
+  }
+  catch (std::exception& e) {
+    std::cerr << "ERROR: " << e.what() << "\n";
+    return 1;
+  }
+
+  return 0;
+}
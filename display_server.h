@@ -0,0 +1,530 @@
+#ifndef __DISPLAY_SERVER_H__
+#define __DISPLAY_SERVER_H__
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <limits>
+#include <new>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "terminal_graphics.h"
+
+
+// Classes to allow multiple processes (e.g. MPI ranks) to display images on
+// the same terminal, without their output becoming interleaved.
+//
+// A single server process creates a named POSIX shared-memory region,
+// holding a ring buffer of fixed-size slots. Any number of client processes
+// can then attach to it by name, and submit frames into the ring buffer,
+// either as indexed images with their colourmap, or as already encoded
+// sixel images. The server takes the frames out of the ring buffer, and
+// writes them to the terminal one at a time. For example, in the server:
+//
+//     std::atomic<bool> stop (false);
+//     TG::DisplayServer server ("/my_display");
+//     server.run (stop);
+//
+// and in each client:
+//
+//     TG::DisplayClient display ("/my_display");
+//     ...
+//     display.submit (image, 0, 255, TG::gray(), rank);
+//
+// Submission is lock-free: clients claim slots using atomic operations
+// only (following D. Vyukov's bounded queue design), so that clients never
+// wait on each other or on the server. If the ring buffer is full, submit()
+// returns false rather than waiting, and the caller can decide whether to
+// retry or drop the frame. Frames are tagged with a `source` identifier:
+// where the server finds several frames pending from the same source, only
+// the most recent is displayed.
+//
+// The server treats the contents of each slot as untrusted: frames whose
+// declared dimensions do not fit within the slot are discarded. A client
+// that stalls (or crashes) after claiming a slot but before publishing it
+// would otherwise block all subsequent frames: if a claimed slot remains
+// unpublished for longer than the server's `stall_timeout`, the server
+// abandons it and moves on. Since the client may still be writing to it,
+// the slot is then retired: it is skipped by clients and server alike from
+// then on, reducing the capacity of the ring buffer by one. Should the
+// client eventually attempt to publish the frame, submit() returns false.
+//
+// Creating a server replaces any existing shared memory region of the same
+// name, such as may have been left behind by a server that crashed. Clients
+// still attached to the previous region will need to re-attach.
+//
+// A minimal server program is provided in display_server.cpp.
+
+
+namespace TG {
+
+  // identifies a valid display server shared memory region:
+  inline constexpr std::uint64_t display_server_magic = 0x5447445350303031ULL;   // "TGDSP001"
+
+  // header at the start of the shared memory region. Producer & consumer
+  // positions are kept on separate cache lines:
+  struct DisplayRing {
+    std::atomic<std::uint64_t> magic;
+    std::uint32_t nslots;
+    std::uint32_t slot_size;
+    alignas(64) std::atomic<std::uint64_t> enqueue_pos;
+    alignas(64) std::atomic<std::uint64_t> dequeue_pos;
+  };
+
+  // header at the start of each slot, followed by `slot_size` bytes of
+  // payload. For indexed images, the payload holds the colourmap (3 bytes
+  // per entry), followed by the pixel data in row-major order:
+  struct DisplaySlot {
+    enum Kind : std::uint32_t { Indexed, Encoded };
+    std::atomic<std::uint64_t> sequence;
+    Kind kind;
+    std::int32_t source;
+    std::uint32_t width, height, cmap_size;
+    std::uint32_t size;
+  };
+
+  static_assert (std::atomic<std::uint64_t>::is_always_lock_free,
+      "display server requires lock-free 64-bit atomics");
+
+  // set in the sequence number of a slot abandoned by the server:
+  inline constexpr std::uint64_t display_slot_retired = std::uint64_t (1) << 63;
+
+  constexpr std::size_t display_slot_stride (std::size_t slot_size)
+  {
+    return (sizeof (DisplaySlot) + slot_size + 63) & ~std::size_t (63);
+  }
+
+
+
+
+  //! Server process for TG::DisplayClient, writing frames to the terminal
+  /** See the description at the top of display_server.h for details. */
+  class DisplayServer {
+    public:
+      //! create the shared memory region `name`, with `nslots` slots of `slot_size` bytes each
+      /** Slots claimed by a client but left unpublished for longer than
+       * `stall_timeout` are skipped. */
+      DisplayServer (const std::string& name, int nslots = 16, std::size_t slot_size = 4U<<20,
+          std::chrono::milliseconds stall_timeout = std::chrono::seconds (1));
+      ~DisplayServer ();
+      DisplayServer (const DisplayServer&) = delete;
+      DisplayServer& operator= (const DisplayServer&) = delete;
+
+      //! display all frames submitted since the last call, returning the number of frames displayed
+      int update (Sink& sink = default_sink());
+
+      //! repeatedly invoke update(), waiting `interval` between calls, until `stop` is set
+      void run (const std::atomic<bool>& stop, Sink& sink = default_sink(),
+          std::chrono::milliseconds interval = std::chrono::milliseconds (10));
+
+    private:
+      struct Frame {
+        DisplaySlot::Kind kind;
+        int width, height;
+        ColourMap cmap;
+        std::vector<ctype> pixels;
+        std::string encoded;
+      };
+
+      const std::string name;
+      const std::chrono::milliseconds stall_timeout;
+      std::size_t mapping_size;
+      DisplayRing* ring;
+
+      // slot claimed but not yet published by a client, and since when:
+      std::uint64_t stalled_pos = ~std::uint64_t (0);
+      std::chrono::steady_clock::time_point stalled_since;
+
+      bool read_frame (DisplaySlot* slot, Frame& frame) const;
+  };
+
+
+
+
+  //! Client to submit frames for display via a TG::DisplayServer
+  /** See the description at the top of display_server.h for details. */
+  class DisplayClient {
+    public:
+      //! attach to the shared memory region `name`, created by the server
+      DisplayClient (const std::string& name);
+      ~DisplayClient ();
+      DisplayClient (const DisplayClient&) = delete;
+      DisplayClient& operator= (const DisplayClient&) = delete;
+
+      //! submit an indexed image, to be displayed using the colourmap supplied
+      /** ImageType is as expected by TG::imshow(). Returns `false` if the
+       * ring buffer is currently full. */
+      template <class ImageType>
+        bool submit (const ImageType& image, const ColourMap& cmap, int source = 0);
+
+      //! submit a scalar image, to be displayed rescaled between (min, max)
+      template <class ImageType>
+        bool submit (const ImageType& image, double min, double max, const ColourMap& cmap = gray(), int source = 0);
+
+      //! submit an image already encoded for display
+      /** This can be any data to be written to the terminal as is, for
+       * example as captured using a TG::BufferSink. */
+      bool submit (std::string_view encoded, int source = 0);
+
+    private:
+      std::size_t mapping_size;
+      DisplayRing* ring;
+
+      DisplaySlot* claim (std::uint64_t& pos);
+      static bool publish (DisplaySlot* slot, std::uint64_t pos);
+  };
+
+
+
+
+  // **************************************************************************
+  // **************************************************************************
+  //
+  //              Implementation details from this point on
+  //
+  // **************************************************************************
+  // **************************************************************************
+
+
+
+  namespace {
+
+    inline DisplaySlot* display_slot (DisplayRing* ring, std::uint64_t pos)
+    {
+      auto* base = reinterpret_cast<unsigned char*> (ring) + sizeof (DisplayRing);
+      return reinterpret_cast<DisplaySlot*> (base + (pos % ring->nslots) * display_slot_stride (ring->slot_size));
+    }
+
+    inline unsigned char* display_payload (DisplaySlot* slot)
+    {
+      return reinterpret_cast<unsigned char*> (slot) + sizeof (DisplaySlot);
+    }
+
+  }
+
+
+
+
+  // **************************************************************************
+  //                   DisplayServer implementation
+  // **************************************************************************
+
+  inline DisplayServer::DisplayServer (const std::string& name, int nslots, std::size_t slot_size,
+      std::chrono::milliseconds stall_timeout) :
+    name (name),
+    stall_timeout (stall_timeout),
+    mapping_size (sizeof (DisplayRing) + nslots * display_slot_stride (slot_size)),
+    ring (nullptr)
+  {
+    if (nslots < 1 || slot_size < 1 || slot_size > std::numeric_limits<std::uint32_t>::max())
+      throw std::runtime_error (std::format ("invalid display server configuration ({} slots of {} bytes)", nslots, slot_size));
+
+    // remove any stale region left behind by a previous server:
+    ::shm_unlink (name.c_str());
+    const int fd = ::shm_open (name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+      throw std::runtime_error (std::format ("unable to create shared memory \"{}\" for display server: {}", name, std::strerror (errno)));
+
+    void* mapping = MAP_FAILED;
+    if (::ftruncate (fd, mapping_size) == 0)
+      mapping = ::mmap (nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close (fd);
+    if (mapping == MAP_FAILED) {
+      ::shm_unlink (name.c_str());
+      throw std::runtime_error (std::format ("unable to map shared memory \"{}\" for display server: {}", name, std::strerror (errno)));
+    }
+
+    ring = new (mapping) DisplayRing;
+    ring->magic.store (0, std::memory_order_relaxed);
+    ring->nslots = nslots;
+    ring->slot_size = slot_size;
+    ring->enqueue_pos.store (0, std::memory_order_relaxed);
+    ring->dequeue_pos.store (0, std::memory_order_relaxed);
+    for (int n = 0; n < nslots; ++n) {
+      auto* slot = new (display_slot (ring, n)) DisplaySlot;
+      slot->sequence.store (n, std::memory_order_relaxed);
+    }
+
+    // only mark the region as valid once fully initialised:
+    ring->magic.store (display_server_magic, std::memory_order_release);
+  }
+
+
+
+  inline DisplayServer::~DisplayServer ()
+  {
+    ::munmap (ring, mapping_size);
+    ::shm_unlink (name.c_str());
+  }
+
+
+
+  // copy the frame held in the slot, returning false if its contents are
+  // inconsistent. The slot is written by client processes, and so cannot be
+  // trusted not to overrun the payload area. Each field is read only once,
+  // since a misbehaving client may modify them concurrently:
+  inline bool DisplayServer::read_frame (DisplaySlot* slot, Frame& frame) const
+  {
+    const std::uint64_t slot_size = ring->slot_size;
+    const unsigned char* payload = display_payload (slot);
+
+    frame.kind = slot->kind;
+    if (frame.kind == DisplaySlot::Encoded) {
+      const std::uint64_t size = slot->size;
+      if (size > slot_size)
+        return false;
+      frame.encoded.assign (reinterpret_cast<const char*> (payload), size);
+      return true;
+    }
+    if (frame.kind != DisplaySlot::Indexed)
+      return false;
+
+    const std::uint64_t width = slot->width, height = slot->height, cmap_size = slot->cmap_size;
+    if (width < 1 || height < 1 || cmap_size < 1 || 3*cmap_size + width*height > slot_size ||
+        width*height > std::uint64_t (std::numeric_limits<int>::max()))
+      return false;
+
+    frame.width = width;
+    frame.height = height;
+    frame.cmap.resize (cmap_size);
+    std::memcpy (frame.cmap.data(), payload, 3*cmap_size);
+    payload += 3*cmap_size;
+    frame.pixels.assign (payload, payload + width*height);
+    // ensure all pixel values index into the colourmap:
+    for (auto& p : frame.pixels)
+      p = std::min<std::uint64_t> (p, cmap_size-1);
+    return true;
+  }
+
+
+
+  inline int DisplayServer::update (Sink& sink)
+  {
+    // take all pending frames out of the ring buffer, keeping only the most
+    // recent for each source:
+    std::map<int,Frame> frames;
+    std::uint64_t pos = ring->dequeue_pos.load (std::memory_order_relaxed);
+    while (true) {
+      DisplaySlot* slot = display_slot (ring, pos);
+      std::uint64_t sequence = slot->sequence.load (std::memory_order_acquire);
+      if (sequence & display_slot_retired) {
+        // retired slots are skipped, once clients have moved past them:
+        if (ring->enqueue_pos.load (std::memory_order_relaxed) <= pos)
+          break;
+        ring->dequeue_pos.store (++pos, std::memory_order_relaxed);
+        continue;
+      }
+      if (sequence != pos+1) {
+        // stop unless the slot has been claimed by a client, but not yet
+        // published for longer than the timeout:
+        if (sequence != pos || ring->enqueue_pos.load (std::memory_order_relaxed) <= pos)
+          break;
+        const auto now = std::chrono::steady_clock::now();
+        if (stalled_pos != pos) {
+          stalled_pos = pos;
+          stalled_since = now;
+          break;
+        }
+        if (now - stalled_since < stall_timeout)
+          break;
+        // abandon the slot. It cannot be handed back to clients, since the
+        // stalled client may still write to it, so is retired instead. This
+        // fails if the client has just published it, in which case it can be
+        // processed as normal:
+        if (!slot->sequence.compare_exchange_strong (sequence, pos | display_slot_retired, std::memory_order_acq_rel))
+          continue;
+        ring->dequeue_pos.store (++pos, std::memory_order_relaxed);
+        continue;
+      }
+
+      Frame frame;
+      const int source = slot->source;
+      if (read_frame (slot, frame))
+        frames.insert_or_assign (source, std::move (frame));
+
+      // hand slot back to producers, for use on the next lap of the ring:
+      slot->sequence.store (pos + ring->nslots, std::memory_order_release);
+      ring->dequeue_pos.store (++pos, std::memory_order_relaxed);
+    }
+
+    struct FrameView {
+      const Frame& frame;
+      int width () const { return frame.width; }
+      int height () const { return frame.height; }
+      int operator() (int x, int y) const { return frame.pixels[x+frame.width*y]; }
+    };
+
+    for (const auto& [ source, frame ] : frames) {
+      if (frame.kind == DisplaySlot::Encoded)
+        sink.write (frame.encoded);
+      else
+        imshow (FrameView { frame }, frame.cmap, sink);
+    }
+    return frames.size();
+  }
+
+
+
+  inline void DisplayServer::run (const std::atomic<bool>& stop, Sink& sink, std::chrono::milliseconds interval)
+  {
+    while (!stop.load()) {
+      if (!update (sink))
+        std::this_thread::sleep_for (interval);
+    }
+  }
+
+
+
+
+  // **************************************************************************
+  //                   DisplayClient implementation
+  // **************************************************************************
+
+  inline DisplayClient::DisplayClient (const std::string& name) :
+    mapping_size (0),
+    ring (nullptr)
+  {
+    const int fd = ::shm_open (name.c_str(), O_RDWR, 0);
+    if (fd < 0)
+      throw std::runtime_error (std::format ("unable to open shared memory \"{}\" for display client: {}", name, std::strerror (errno)));
+
+    struct stat st;
+    void* mapping = MAP_FAILED;
+    if (::fstat (fd, &st) == 0 && std::size_t (st.st_size) >= sizeof (DisplayRing)) {
+      mapping_size = st.st_size;
+      mapping = ::mmap (nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    ::close (fd);
+    if (mapping == MAP_FAILED)
+      throw std::runtime_error (std::format ("unable to map shared memory \"{}\" for display client", name));
+
+    ring = static_cast<DisplayRing*> (mapping);
+    if (ring->magic.load (std::memory_order_acquire) != display_server_magic ||
+        mapping_size < sizeof (DisplayRing) + ring->nslots * display_slot_stride (ring->slot_size)) {
+      ::munmap (mapping, mapping_size);
+      throw std::runtime_error (std::format ("shared memory \"{}\" does not hold a valid display server", name));
+    }
+  }
+
+
+
+  inline DisplayClient::~DisplayClient ()
+  {
+    ::munmap (ring, mapping_size);
+  }
+
+
+
+  // claim the next free slot, or return nullptr if the ring buffer is full.
+  // Competing clients race to advance the enqueue position; the slot's
+  // sequence number indicates whether it has been released by the server.
+  // Slots retired by the server are skipped over:
+  inline DisplaySlot* DisplayClient::claim (std::uint64_t& pos)
+  {
+    pos = ring->enqueue_pos.load (std::memory_order_relaxed);
+    for (std::uint32_t skipped = 0; true; ) {
+      DisplaySlot* slot = display_slot (ring, pos);
+      const std::uint64_t sequence = slot->sequence.load (std::memory_order_acquire);
+      if (sequence & display_slot_retired) {
+        if (++skipped >= ring->nslots)
+          return nullptr;
+        if (ring->enqueue_pos.compare_exchange_weak (pos, pos+1, std::memory_order_relaxed))
+          ++pos;
+        continue;
+      }
+      const auto diff = static_cast<std::int64_t> (sequence - pos);
+      if (diff == 0) {
+        if (ring->enqueue_pos.compare_exchange_weak (pos, pos+1, std::memory_order_relaxed))
+          return slot;
+      }
+      else if (diff < 0)
+        return nullptr;
+      else
+        pos = ring->enqueue_pos.load (std::memory_order_relaxed);
+    }
+  }
+
+
+
+  // make the frame in the claimed slot available to the server. This fails if
+  // the server has abandoned the slot in the meantime (see stall_timeout):
+  inline bool DisplayClient::publish (DisplaySlot* slot, std::uint64_t pos)
+  {
+    return slot->sequence.compare_exchange_strong (pos, pos+1, std::memory_order_release, std::memory_order_relaxed);
+  }
+
+
+
+  template <class ImageType>
+    inline bool DisplayClient::submit (const ImageType& image, const ColourMap& cmap, int source)
+    {
+      const std::size_t size = 3*cmap.size() + std::size_t (image.width()) * image.height();
+      if (size > ring->slot_size)
+        throw std::runtime_error (std::format ("image too large for display server ({} bytes > {})", size, ring->slot_size));
+
+      std::uint64_t pos;
+      DisplaySlot* slot = claim (pos);
+      if (!slot)
+        return false;
+
+      slot->kind = DisplaySlot::Indexed;
+      slot->source = source;
+      slot->width = image.width();
+      slot->height = image.height();
+      slot->cmap_size = cmap.size();
+      slot->size = size;
+      unsigned char* payload = display_payload (slot);
+      std::memcpy (payload, cmap.data(), 3*cmap.size());
+      payload += 3*cmap.size();
+      for (int y = 0; y < image.height(); ++y)
+        for (int x = 0; x < image.width(); ++x)
+          *payload++ = image(x,y);
+
+      return publish (slot, pos);
+    }
+
+
+
+  template <class ImageType>
+    inline bool DisplayClient::submit (const ImageType& image, double min, double max, const ColourMap& cmap, int source)
+    {
+      return submit (Rescale<ImageType> (image, min, max, cmap.size()), cmap, source);
+    }
+
+
+
+  inline bool DisplayClient::submit (std::string_view encoded, int source)
+  {
+    if (encoded.size() > ring->slot_size)
+      throw std::runtime_error (std::format ("encoded image too large for display server ({} bytes > {})", encoded.size(), ring->slot_size));
+
+    std::uint64_t pos;
+    DisplaySlot* slot = claim (pos);
+    if (!slot)
+      return false;
+
+    slot->kind = DisplaySlot::Encoded;
+    slot->source = source;
+    slot->width = slot->height = slot->cmap_size = 0;
+    slot->size = encoded.size();
+    std::memcpy (display_payload (slot), encoded.data(), encoded.size());
+
+    return publish (slot, pos);
+  }
+
+}
+
+#endif
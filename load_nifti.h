@@ -0,0 +1,280 @@
+#ifndef __NIFTI_H__
+#define __NIFTI_H__
+
+#include <fstream>
+#include <string>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "terminal_graphics.h"
+
+
+// Simple class to access a NIfTI-1 image, stored either as a single .nii
+// file, or as a .hdr/.img file pair. Compressed (.nii.gz) images are not
+// supported.
+//
+// The voxel data are memory-mapped rather than read into memory, so that
+// opening even very large images is immediate: only those parts of the file
+// that are actually accessed are ever read from disk. Likewise, the scaling
+// specified by the scl_slope & scl_inter header fields is applied on the fly
+// as each voxel value is retrieved, rather than by converting the data up
+// front.
+//
+// The object provides the methods expected of a volume by TG::slice(),
+// operating on the first volume of a 4D series. Other volumes can be accessed
+// via the volume() method. For example:
+//
+//     const auto nii = load_nifti ("image.nii");
+//     TG::imshow (TG::slice (nii, 2, nii.depth()/2), 0, 1000);
+//     TG::imshow (TG::slice (nii.volume (5), 0, 60), 0, 1000);
+
+
+class NIfTI {
+  public:
+    NIfTI (const std::string& filename);
+    NIfTI (NIfTI&& other) noexcept;
+    NIfTI (const NIfTI&) = delete;
+    ~NIfTI ();
+
+    // query image dimensions:
+    int ndim () const { return dims[0]; }
+    int size (int axis) const { return dims[axis+1]; }
+    float voxel_size (int axis) const { return pixdim[axis+1]; }
+
+    int width () const { return size(0); }
+    int height () const { return size(1); }
+    int depth () const { return size(2); }
+    int volumes () const { return size(3); }
+
+    // NIfTI datatype code & intensity scaling parameters, as stored in the header:
+    int datatype () const { return type; }
+    double slope () const { return scl_slope; }
+    double intercept () const { return scl_inter; }
+
+    // query the (scaled) intensity at the specified voxel:
+    double operator() (int x, int y, int z, int t = 0) const {
+      return value (x + std::size_t (dims[1]) * (y + std::size_t (dims[2]) * (z + std::size_t (dims[3]) * t)));
+    }
+
+    // query the (scaled) intensity at the specified offset into the voxel data:
+    double value (std::size_t offset) const {
+      return scl_slope * read (data + offset*bytes_per_voxel) + scl_inter;
+    }
+
+    // lightweight view onto a single 3D volume of a 4D series:
+    class Volume {
+      public:
+        Volume (const NIfTI& image, int t) : im (image), t (t) { }
+        int width () const { return im.width(); }
+        int height () const { return im.height(); }
+        int depth () const { return im.depth(); }
+        double operator() (int x, int y, int z) const { return im (x, y, z, t); }
+      private:
+        const NIfTI& im;
+        const int t;
+    };
+
+    Volume volume (int t) const {
+      if (t < 0 || t >= volumes())
+        throw std::runtime_error ("volume index out of range for NIfTI image \"" + filename + "\"");
+      return { *this, t };
+    }
+
+  private:
+    std::string filename;
+    std::array<int,8> dims;
+    std::array<float,8> pixdim;
+    int type, bytes_per_voxel;
+    double scl_slope, scl_inter;
+
+    void* mapping;
+    std::size_t mapping_size;
+    const unsigned char* data;
+    double (*read) (const unsigned char*);
+
+    template <typename T, bool swap>
+      static T get_as (const unsigned char* p) {
+        unsigned char bytes[sizeof(T)];
+        std::memcpy (bytes, p, sizeof(T));
+        if constexpr (swap)
+          std::reverse (bytes, bytes+sizeof(T));
+        T val;
+        std::memcpy (&val, bytes, sizeof(T));
+        return val;
+      }
+
+    template <typename T, bool swap>
+      static double read_as (const unsigned char* p) { return get_as<T,swap> (p); }
+
+    template <bool swap>
+      static double (*get_reader (int datatype)) (const unsigned char*) {
+        switch (datatype) {
+          case 2:    return read_as<uint8_t,swap>;
+          case 4:    return read_as<int16_t,swap>;
+          case 8:    return read_as<int32_t,swap>;
+          case 16:   return read_as<float,swap>;
+          case 64:   return read_as<double,swap>;
+          case 256:  return read_as<int8_t,swap>;
+          case 512:  return read_as<uint16_t,swap>;
+          case 768:  return read_as<uint32_t,swap>;
+          case 1024: return read_as<int64_t,swap>;
+          case 1280: return read_as<uint64_t,swap>;
+          default:   return nullptr;
+        }
+      }
+
+    static int datatype_size (int datatype) {
+      switch (datatype) {
+        case 2: case 256:               return 1;
+        case 4: case 512:               return 2;
+        case 8: case 16: case 768:      return 4;
+        case 64: case 1024: case 1280:  return 8;
+        default:                        return 0;
+      }
+    }
+};
+
+
+inline NIfTI load_nifti (const std::string& filename) { return NIfTI (filename); }
+
+
+
+
+inline NIfTI::NIfTI (const std::string& nifti_filename) :
+  filename (nifti_filename),
+  mapping (MAP_FAILED),
+  mapping_size (0)
+{
+  auto ends_with = [&] (const std::string& suffix) {
+    return filename.size() >= suffix.size() &&
+      filename.compare (filename.size()-suffix.size(), suffix.size(), suffix) == 0;
+  };
+
+  if (ends_with (".gz"))
+    throw std::runtime_error ("compressed NIfTI image \"" + filename + "\" cannot be memory-mapped - please decompress first");
+
+  const bool separate_header = ends_with (".hdr") || ends_with (".img");
+  std::string data_filename = filename;
+  if (separate_header) {
+    filename.replace (filename.size()-4, 4, ".hdr");
+    data_filename.replace (data_filename.size()-4, 4, ".img");
+  }
+
+  std::ifstream in (filename, std::ios::binary);
+  if (!in)
+    throw std::runtime_error ("failed to open input NIfTI file \"" + filename + "\"");
+
+  unsigned char header[348];
+  if (!in.read (reinterpret_cast<char*> (header), sizeof(header)))
+    throw std::runtime_error ("failed to read header of NIfTI file \"" + filename + "\"");
+
+  if (std::memcmp (header+344, separate_header ? "ni1" : "n+1", 4) != 0)
+    throw std::runtime_error ("input file \"" + filename + "\" is not in expected NIfTI-1 format");
+
+  int32_t sizeof_hdr;
+  std::memcpy (&sizeof_hdr, header, 4);
+  const bool swap = sizeof_hdr != 348;
+
+  auto get_int = [&] (int offset) -> int {
+    return swap ? get_as<int16_t,true> (header+offset) : get_as<int16_t,false> (header+offset);
+  };
+  auto get_float = [&] (int offset) -> float {
+    return swap ? get_as<float,true> (header+offset) : get_as<float,false> (header+offset);
+  };
+
+  if ((swap ? get_as<int32_t,true> (header) : sizeof_hdr) != 348)
+    throw std::runtime_error ("NIfTI file \"" + filename + "\" is badly formed: unexpected header size");
+
+  for (int n = 0; n < 8; ++n) {
+    dims[n] = get_int (40+2*n);
+    pixdim[n] = get_float (76+4*n);
+  }
+  if (dims[0] < 1 || dims[0] > 7)
+    throw std::runtime_error ("NIfTI file \"" + filename + "\" is badly formed: invalid number of dimensions");
+
+  std::size_t nvoxels = 1;
+  for (int n = 1; n < 8; ++n) {
+    if (n > dims[0]) {
+      dims[n] = 1;
+      pixdim[n] = 1.0f;
+    }
+    if (dims[n] < 1)
+      throw std::runtime_error ("NIfTI file \"" + filename + "\" is badly formed: invalid image dimensions");
+    nvoxels *= dims[n];
+  }
+
+  type = get_int (70);
+  bytes_per_voxel = datatype_size (type);
+  read = swap ? get_reader<true> (type) : get_reader<false> (type);
+  if (!read || bytes_per_voxel <= 0)
+    throw std::runtime_error ("unsupported datatype (" + std::to_string (type) + ") in NIfTI file \"" + filename + "\"");
+  if (get_int (72) != 8*bytes_per_voxel)
+    throw std::runtime_error ("NIfTI file \"" + filename + "\" is badly formed: bitpix does not match datatype");
+
+  scl_slope = get_float (112);
+  scl_inter = get_float (116);
+  if (scl_slope == 0.0 || !std::isfinite (scl_slope) || !std::isfinite (scl_inter)) {
+    scl_slope = 1.0;
+    scl_inter = 0.0;
+  }
+
+  const float vox_offset = separate_header ? 0.0f : get_float (108);
+  if (!std::isfinite (vox_offset) || vox_offset < 0.0f || vox_offset != std::floor (vox_offset))
+    throw std::runtime_error ("NIfTI file \"" + filename + "\" is badly formed: invalid voxel offset");
+  const std::size_t offset = vox_offset;
+
+  int fd = open (data_filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw std::runtime_error ("failed to open data file \"" + data_filename + "\" for NIfTI image");
+
+  struct stat st;
+  if (fstat (fd, &st) || std::size_t (st.st_size) < offset + nvoxels*bytes_per_voxel) {
+    close (fd);
+    throw std::runtime_error ("data file \"" + data_filename + "\" is too small for NIfTI image dimensions");
+  }
+
+  mapping_size = st.st_size;
+  mapping = mmap (nullptr, mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (mapping == MAP_FAILED)
+    throw std::runtime_error ("failed to memory-map data file \"" + data_filename + "\" for NIfTI image");
+
+  data = static_cast<const unsigned char*> (mapping) + offset;
+}
+
+
+
+inline NIfTI::NIfTI (NIfTI&& other) noexcept :
+  filename (std::move (other.filename)),
+  dims (other.dims),
+  pixdim (other.pixdim),
+  type (other.type),
+  bytes_per_voxel (other.bytes_per_voxel),
+  scl_slope (other.scl_slope),
+  scl_inter (other.scl_inter),
+  mapping (other.mapping),
+  mapping_size (other.mapping_size),
+  data (other.data),
+  read (other.read)
+{
+  other.mapping = MAP_FAILED;
+}
+
+
+
+inline NIfTI::~NIfTI ()
+{
+  if (mapping != MAP_FAILED)
+    munmap (mapping, mapping_size);
+}
+
+#endif
@@ -22,10 +22,38 @@
 #include <ranges>
 #include <limits>
 #include <cmath>
+#include <complex>
+#include <bit>
+#include <cstdint>
 #include <iomanip>
 #include <algorithm>
 #include <stdexcept>
 #include <cstdlib>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <optional>
+#include <utility>
+#include <atomic>
+#include <concepts>
+#include <span>
+#include <string_view>
+#include <functional>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <exception>
+#include <list>
+#include <unordered_map>
+#include <random>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#endif
 
 
 /**
@@ -42,6 +70,9 @@
  * - macOS: iTerm2
  * - Windows:minTTY
  *
+ * Terminals that support the kitty graphics protocol instead (e.g. kitty,
+ * Ghostty) can be used by selecting that protocol, see TG::set_protocol().
+ *
  * To use in your code, place this file alongside your own code, and \#include
  * the file where necessary:
  *
@@ -52,8 +83,9 @@
  *
  * The main functions of interest are:
  *
- * - TG::imshow()  display a scalar image.
+ * - TG::imshow()  display a scalar, indexed or RGB image.
  * - TG::plot()    display a simple line plot for the data supplied
+ * - TG::orthoview()  display orthogonal slices through a volume
  *
  * For a more complete list of all of the available functionality, refer to the
  * TG namespace.
@@ -104,13 +136,25 @@ namespace TG {
   using ColourMap = std::vector<std::array<ctype,3>>;
 
   //! convenience function to generate a ready-made grayscale colourmap
-  ColourMap gray (int number = 101);
+  /** When invoked without arguments, this (and the other ready-made
+   * colourmaps below) returns a reference to a 101-entry colourmap
+   * computed at compile-time, at no cost. Otherwise, a colourmap with the
+   * requested number of entries is generated. */
+  const ColourMap& gray ();
+  ColourMap gray (int number);
 
   //! convenience function to generate a ready-made hot colourmap
-  ColourMap hot (int number = 101);
+  const ColourMap& hot ();
+  ColourMap hot (int number);
 
   //! convenience function to generate a ready-made jet colourmap
-  ColourMap jet (int number = 101);
+  const ColourMap& jet ();
+  ColourMap jet (int number);
+
+  //! convenience function to generate a ready-made viridis colourmap
+  /** This is the perceptually uniform colourmap introduced in matplotlib. */
+  const ColourMap& viridis ();
+  ColourMap viridis (int number);
 
 
 
@@ -129,7 +173,9 @@ namespace TG {
    *     ...
    *   }
    * ```
-   * \sa TG::Clear
+   * For animations, TG::InPlace is a more efficient alternative.
+   *
+   * \sa TG::Clear, TG::InPlace
    */
   constexpr std::string Home = "\033[H";
 
@@ -138,6 +184,402 @@ namespace TG {
    */
   constexpr std::string Clear = "\033[2J";
 
+
+
+
+  //! The interface for destinations of the encoded images
+  /**
+   * All functions that display images to the terminal write the fully
+   * encoded image to a Sink, provided as an optional argument, or to the
+   * default sink for the current thread if not specified (see
+   * TG::set_default_sink()). By default, this writes to `std::cout`.
+   *
+   * The following implementations are provided:
+   * - TG::StreamSink writes to any `std::ostream`
+   * - TG::FileSink writes directly to a file descriptor, bypassing iostreams
+   *   (POSIX systems only)
+   * - TG::BufferSink accumulates the data in memory
+   * - TG::CallbackSink passes the data to a user-supplied function
+   * - TG::ConcurrentSink allows any number of threads to share another sink
+   *
+   * Custom sinks can be implemented by deriving from this class. Each call to
+   * write() corresponds to a whole image, possibly split over multiple
+   * buffers, which should be written in order.
+   */
+  class Sink {
+    public:
+      virtual ~Sink () = default;
+
+      //! write the buffers supplied, in order
+      virtual void write (std::span<const std::string_view> buffers) = 0;
+      //! write a single buffer
+      void write (std::string_view data) { write (std::span (&data, 1)); }
+
+      //! write data that must never be dropped, such as control sequences
+      /** Sinks that may drop images (e.g. TG::NonBlockingSink) must still
+       * write these data, in order. By default, this is equivalent to
+       * write(). */
+      virtual void write_control (std::string_view data) { write (data); }
+
+      //! whether all data are written directly to a terminal
+      /** This allows images to refer to resources (such as the shared memory
+       * objects used by TG::Protocol::Kitty) that must be consumed by the
+       * terminal. Sinks that may discard data should return `false`. */
+      virtual bool writes_to_terminal () const { return false; }
+  };
+
+  //! A Sink to write to any `std::ostream`, flushing after each image
+  class StreamSink : public Sink {
+    public:
+      StreamSink (std::ostream& stream) : stream (stream) { }
+      using Sink::write;
+      void write (std::span<const std::string_view> buffers) override;
+      bool writes_to_terminal () const override;
+    private:
+      std::ostream& stream;
+  };
+
+#if defined(__unix__) || defined(__APPLE__)
+  //! A Sink to write directly to a file descriptor
+  /**
+   * This writes all buffers in a single writev() call where possible (e.g.
+   * to `STDOUT_FILENO`, or a file descriptor opened on `/dev/tty` or any other
+   * terminal). The file descriptor is not closed on destruction.
+   */
+  class FileSink : public Sink {
+    public:
+      FileSink (int fd) : fd (fd) { }
+      using Sink::write;
+      void write (std::span<const std::string_view> buffers) override;
+      bool writes_to_terminal () const override { return ::isatty (fd); }
+    private:
+      const int fd;
+  };
+
+  //! A Sink to write to a file descriptor without blocking
+  /**
+   * Large images can take a long time to write to a slow terminal or
+   * connection, and a blocking write would stall the caller for that time.
+   * This sink instead puts the file descriptor in non-blocking mode, writes
+   * as much of each image as possible immediately (using writev() on the
+   * buffers as supplied), and retains the remainder to be written later,
+   * without blocking. Each call to write() or flush() makes further
+   * progress.
+   *
+   * An image that has been partially written must be completed, so as not to
+   * leave the terminal in the middle of an escape sequence. But if a new
+   * image is supplied while the previous one is still being written, it is
+   * held back until the previous one is done. Any image already held back at
+   * that point is dropped, since it would be out of date by then: frames are
+   * coalesced, so the backlog never exceeds one frame beyond the current
+   * one. Data written using write_control() are never dropped. Callers can
+   * also check busy() to skip rendering a frame altogether while the
+   * terminal is not keeping up. For example:
+   *
+   *     const int tty = ::open ("/dev/tty", O_WRONLY);
+   *     {
+   *       TG::NonBlockingSink sink (tty);
+   *       while (running) {
+   *         ...
+   *         if (!sink.busy())
+   *           TG::imshow (frame, 0, 255, TG::gray(), sink);
+   *       }
+   *       sink.flush();
+   *     }
+   *     ::close (tty);
+   *
+   * Note that the non-blocking mode applies to the open file description,
+   * which is shared with any duplicates of the file descriptor, including
+   * those inherited from or by other processes. Using `STDOUT_FILENO`
+   * directly would therefore also affect `std::cout`, `printf()`, and the
+   * parent shell, whose writes may then fail with `EAGAIN`. Opening
+   * `/dev/tty` separately (as above) avoids this, since it creates a new
+   * file description. The original flags of the file descriptor are
+   * restored on destruction, after waiting for any remaining data to be
+   * written; they will not be restored if the program is terminated
+   * before then.
+   */
+  class NonBlockingSink : public Sink {
+    public:
+      NonBlockingSink (int fd);
+      ~NonBlockingSink ();
+      NonBlockingSink (const NonBlockingSink&) = delete;
+      NonBlockingSink& operator= (const NonBlockingSink&) = delete;
+
+      using Sink::write;
+      void write (std::span<const std::string_view> buffers) override;
+      void write_control (std::string_view data) override;
+
+      //! wait until all pending data have been written, or until `timeout` (in milliseconds) expires
+      /** A negative `timeout` waits indefinitely. Returns `true` if all data
+       * have been written. */
+      bool flush (int timeout = -1);
+
+      //! whether data from previous images remain to be written
+      bool busy () const { return current.size() || queued.size(); }
+      //! the number of bytes remaining to be written
+      std::size_t pending () const { return current.size() - offset + queued.size(); }
+      //! the number of images dropped so far, having been superseded before they could be written
+      std::size_t dropped () const { return ndropped; }
+
+    private:
+      const int fd;
+      int original_flags;
+      std::string current, queued;
+      // the queued image occupies (queued_begin, queued_end) within
+      // `queued`, and may be surrounded by control data:
+      std::size_t offset, queued_begin, queued_end, ndropped;
+
+      std::size_t write_some (std::vector<iovec>& iov);
+      void write_now (std::span<const std::string_view> buffers);
+      void progress ();
+  };
+#endif
+
+  //! A Sink to accumulate the data in memory
+  class BufferSink : public Sink {
+    public:
+      using Sink::write;
+      void write (std::span<const std::string_view> buffers) override;
+
+      //! the data written so far
+      const std::string& str () const { return data; }
+      //! discard the data written so far
+      void clear () { data.clear(); }
+    private:
+      std::string data;
+  };
+
+  //! A Sink to pass the data to a user-supplied function
+  /** The function is invoked once per buffer. */
+  class CallbackSink : public Sink {
+    public:
+      CallbackSink (std::function<void(std::string_view)> callback) : callback (std::move (callback)) { }
+      using Sink::write;
+      void write (std::span<const std::string_view> buffers) override;
+    private:
+      std::function<void(std::string_view)> callback;
+  };
+
+  //! A Sink that can safely be written to from any number of threads
+  /**
+   * Images displayed concurrently from different threads to the same
+   * terminal would otherwise have their escape sequences interleaved. With
+   * this sink, each thread still encodes its own images in parallel, but
+   * then hands the encoded data over to a single writer thread via a
+   * lock-free queue. The writer passes each image in turn to the target
+   * sink, so that images are always written whole, in the order they were
+   * submitted. For example:
+   *
+   *     std::vector<std::thread> threads;
+   *     for (int n = 0; n < 4; ++n)
+   *       threads.emplace_back ([n] {
+   *         TG::set_default_sink (&TG::display_channel());
+   *         ...
+   *         TG::imshow (image[n], 0, 255);
+   *       });
+   *
+   * write() returns as soon as the data have been queued. If the target sink
+   * fails, no further data are written, and the error is reported by any
+   * subsequent call to write() or flush(). Any remaining data are written on
+   * destruction.
+   */
+  class ConcurrentSink : public Sink {
+    public:
+      ConcurrentSink (Sink& target);
+      ~ConcurrentSink ();
+      ConcurrentSink (const ConcurrentSink&) = delete;
+      ConcurrentSink& operator= (const ConcurrentSink&) = delete;
+
+      using Sink::write;
+      void write (std::span<const std::string_view> buffers) override;
+      void write_control (std::string_view data) override;
+
+      //! wait until all images submitted so far have been written
+      void flush ();
+
+    private:
+      struct Node {
+        Node* next;
+        std::string data;
+        bool control = false;
+      };
+
+      Sink& target;
+      std::atomic<Node*> head;
+      std::atomic<std::uint64_t> submitted, written;
+      std::exception_ptr error;
+      std::atomic<bool> failed;
+      Node stop { nullptr, { }, false };
+      std::thread writer;
+
+      void push (Node* node);
+      void run ();
+      void check ();
+  };
+
+  //! a process-wide ConcurrentSink writing to `std::cout`
+  /** Pass this to TG::set_default_sink() in each thread that displays
+   * images, or provide it explicitly as the sink argument. */
+  ConcurrentSink& display_channel ();
+
+  //! the Sink used when none is specified, for the current thread
+  Sink& default_sink ();
+
+  //! set the default Sink for the current thread
+  /** The sink must remain valid for as long as it is in use. Passing
+   * `nullptr` restores the default (writing to `std::cout`). */
+  void set_default_sink (Sink* sink);
+
+
+
+
+  //! The graphics protocols available to display images
+  /**
+   * - `Sixel` (the default) encodes the images using the sixel protocol,
+   *   supported by many terminals (see README).
+   * - `Kitty` uses the kitty graphics protocol, supported by kitty, WezTerm,
+   *   Ghostty and others. The raw pixel data are sent without any encoding:
+   *   if the terminal is identified as kitty or Ghostty running on the same
+   *   system (i.e. when not logged in via SSH), and the images are written
+   *   directly to it (see Sink::writes_to_terminal()), they are passed via a
+   *   POSIX shared memory object, which the terminal reads & removes;
+   *   otherwise, they are sent inline, base64-encoded.
+   * - `KittyDirect` uses the kitty graphics protocol, always sending the
+   *   data inline.
+   *
+   * With either kitty protocol, images displayed in place (using TG::InPlace
+   * or TG::Progressive) each replace the previous one in the terminal's
+   * memory, rather than accumulating there.
+   *
+   * \sa TG::set_protocol()
+   */
+  enum class Protocol { Sixel, Kitty, KittyDirect };
+
+  //! set the graphics protocol used for all images displayed on the current thread
+  /** This applies to all functions that display images (imshow(),
+   * Plot::show(), etc.). For example:
+   *
+   *     if (std::getenv ("KITTY_WINDOW_ID"))
+   *       TG::set_protocol (TG::Protocol::Kitty);
+   */
+  void set_protocol (Protocol protocol);
+
+  //! the graphics protocol in use on the current thread
+  Protocol get_protocol ();
+
+
+
+
+  //! A class to display successive images in place
+  /**
+   * While an object of this class is in scope, each image displayed on the
+   * same thread (using imshow(), Plot::show(), etc.) replaces the previous
+   * one, rather than being appended below it. This is done by saving the
+   * cursor position (using the VT100 DECSC sequence) before the first image,
+   * and restoring it (using DECRC) before each subsequent image. Unlike
+   * TG::Clear & TG::Home, this only redraws the image itself, with no need
+   * for the terminal to clear, scroll or repaint the rest of the screen. For
+   * example:
+   * ```
+   *   TG::InPlace in_place;
+   *   while (running) {
+   *     ...
+   *     TG::plot().add_line(...);
+   *   }
+   * ```
+   *
+   * If displaying the first image causes the terminal to scroll, the saved
+   * cursor position will no longer match the location of the image. To
+   * avoid this, set `no_scrolling`: this enables sixel display mode
+   * (DECSDM), in which images are drawn from the top-left corner of the
+   * screen and never cause the terminal to scroll. The previous mode is
+   * restored when the object goes out of scope, by writing to `sink`: this
+   * should be the sink the images are displayed on, and must remain valid
+   * for the lifetime of this object.
+   *
+   * Objects of this class can be nested (e.g. when a function that uses
+   * in-place display is called within another in-place display loop). A
+   * nested object has no effect: images displayed within its scope simply
+   * carry on replacing those of the enclosing scope, whose saved cursor
+   * position and settings are left untouched.
+   */
+  class InPlace {
+    public:
+      InPlace (bool no_scrolling = false, Sink& sink = default_sink());
+      ~InPlace ();
+      InPlace (const InPlace&) = delete;
+      InPlace& operator= (const InPlace&) = delete;
+
+    private:
+      Sink& sink;
+      const bool nested;
+  };
+
+
+
+
+  //! A cache of recently encoded images
+  /**
+   * Applications that refresh a display periodically often show the same
+   * images over and over again (e.g. unchanged thumbnails or reference
+   * slices). While an object of this class is in scope, the encoded output of
+   * each image displayed on the same thread (using imshow(), Plot::show(),
+   * etc.) is retained, identified by a 64-bit hash of its contents and of all
+   * the parameters that affect its encoding (intensity range, colourmap,
+   * etc.). When the same image is displayed again, the encoded output is
+   * re-used, skipping rescaling and encoding entirely. For example:
+   *
+   *     TG::FrameCache cache (16<<20);
+   *     while (running) {
+   *       for (const auto& thumbnail : thumbnails)
+   *         TG::imshow (thumbnail, 0, 255);
+   *       ...
+   *     }
+   *
+   * Computing the hash requires a single pass over the image, which costs a
+   * small fraction of the time taken to encode it. Once the total size of the
+   * cached output exceeds `max_bytes`, the least recently used images are
+   * discarded.
+   *
+   * Caches can be nested, in which case the innermost is used. A cache must
+   * only be used on the thread that created it.
+   */
+  class FrameCache {
+    public:
+      FrameCache (std::size_t max_bytes = 64U<<20);
+      ~FrameCache ();
+      FrameCache (const FrameCache&) = delete;
+      FrameCache& operator= (const FrameCache&) = delete;
+
+      //! the encoded image for `key`, or `nullptr` if not present
+      const std::string* find (std::uint64_t key);
+      //! add the encoded image for `key`, discarding older images as needed
+      void insert (std::uint64_t key, std::string encoded);
+      //! discard all cached images
+      void clear ();
+
+      //! the number of images currently cached
+      std::size_t count () const { return entries.size(); }
+      //! the total size in bytes of the images currently cached
+      std::size_t size () const { return bytes; }
+      //! the number of images found in the cache so far
+      std::size_t hits () const { return nhits; }
+      //! the number of images not found in the cache so far
+      std::size_t misses () const { return nmisses; }
+
+    private:
+      using Entry = std::pair<std::uint64_t,std::string>;
+      std::list<Entry> entries;
+      std::unordered_map<std::uint64_t,std::list<Entry>::iterator> index;
+      const std::size_t max_bytes;
+      std::size_t bytes, nhits, nmisses;
+      FrameCache* const previous;
+  };
+
+
+
+
   //! A simple class to hold a 2D image using datatype specified as `ValueType` template parameter
   template <typename ValueType>
     class Image {
@@ -164,6 +606,74 @@ namespace TG {
 
 
 
+  //! A class to hold a 2D indexed image, packing `Bits` bits per pixel
+  /**
+   * This stores colourmap indices using only 1, 2 or 4 bits per pixel,
+   * rather than a full byte as for Image<ctype>. This is well suited to
+   * binary masks (`Bits` = 1) and label images with up to 4 or 16
+   * distinct labels, which then require 8, 4 or 2 times less memory.
+   * Values are truncated to the number of bits available.
+   *
+   * The image can be displayed with imshow() as for any other indexed image;
+   * in this case, the sixels are computed directly from the packed data.
+   * For example:
+   *
+   *     TG::PackedImage<1> mask (width, height);
+   *     ...
+   *     mask(x,y) = 1;
+   *     ...
+   *     TG::imshow (mask, TG::ColourMap { { 0, 0, 0 }, { 100, 100, 0 } });
+   */
+  template <int Bits>
+    class PackedImage {
+      static_assert (Bits == 1 || Bits == 2 || Bits == 4, "PackedImage only supports 1, 2 or 4 bits per pixel");
+      public:
+        //! the type of the words used to hold the pixel data
+        using word_type = std::uint64_t;
+        //! the number of pixels packed into each word
+        static constexpr int pixels_per_word = 64 / Bits;
+
+        //! proxy object returned when accessing a pixel for modification
+        class reference {
+          public:
+            reference (word_type& word, int shift) : word (word), shift (shift) { }
+            operator ctype () const { return (word >> shift) & mask; }
+            reference& operator= (ctype value);
+            reference& operator= (const reference& other) { return *this = ctype (other); }
+          private:
+            word_type& word;
+            const int shift;
+        };
+
+        //! Instantiate a PackedImage with the specified dimensions
+        PackedImage (int x_dim, int y_dim);
+
+        //! query image dimensions
+        int width () const;
+        int height () const;
+
+        //! query or set intensity at coordinates (x,y)
+        reference operator() (int x, int y);
+        //! query intensity at coordinates (x,y)
+        ctype operator() (int x, int y) const;
+
+        //! direct access to the packed words for row y
+        /** Pixel x of the row is held in bits
+         * `(x % pixels_per_word) * Bits` onwards of word
+         * `x / pixels_per_word`. */
+        const word_type* row (int y) const;
+
+        //! clear image, setting all intensities to 0
+        void clear ();
+
+      private:
+        static constexpr word_type mask = (1U << Bits) - 1;
+        const int x_dim, y_dim, stride;
+        std::vector<word_type> data;
+    };
+
+
+
 
   //! Adapter class to rescale intensities of image to colourmap indices
   /**
@@ -188,6 +698,70 @@ namespace TG {
 
 
 
+  //! Adapter class to map intensities of image to colourmap indices nonlinearly
+  /**
+   * This is the class returned by TG::gamma(), TG::logscale() & TG::equalise(),
+   * which are more convenient to use directly. It plays the same role as
+   * TG::Rescale, but allows for arbitrary monotonic mappings.
+   *
+   * On construction, the (min, max) range is divided into (at most 4096)
+   * equal intervals, and the colourmap index for each interval is computed
+   * and stored in a lookup table, by evaluating `func` at the centre of the
+   * interval. `func` is any callable that maps the normalised intensity
+   * within (min, max) onto the normalised position in the colourmap, both in
+   * the range [ 0 1 ]. Displaying the image then only requires a table
+   * lookup per pixel, no matter how expensive the mapping.
+   *
+   * If `logarithmic` is set, intervals are instead equally spaced on a
+   * (piecewise linear approximation to a) logarithmic scale, and the
+   * normalised intensity passed to `func` is computed on a logarithmic
+   * scale. In this case, `min` must be strictly positive.
+   */
+  template <class ImageType>
+    class Remap {
+      public:
+        template <class Functor>
+          Remap (const ImageType& image, double minval, double maxval, int cmap_size,
+              bool logarithmic, Functor&& func);
+
+        int width () const;
+        int height () const;
+        ctype operator() (int x, int y) const;
+
+      private:
+        const ImageType& im;
+        const double min, scale;
+        const bool logarithmic;
+        std::uint32_t key_min;
+        int shift;
+        std::vector<ctype> table;
+
+        static std::uint32_t key (float val) { return std::bit_cast<std::uint32_t> (val); }
+    };
+
+  //! display intensities between (min, max) with gamma correction
+  /** Normalised intensities are raised to the power `gamma` before lookup
+   * in the colourmap: values below 1 brighten the image, values above 1
+   * darken it. Since the mapping goes through the lookup table, gamma = 1
+   * only approximates TG::Rescale: use TG::Rescale directly for an exact
+   * linear mapping. */
+  template <class ImageType>
+    Remap<ImageType> gamma (const ImageType& image, double min, double max, double gamma, int cmap_size);
+
+  //! display intensities between (min, max) on a logarithmic scale
+  /** Both `min` & `max` must be strictly positive. */
+  template <class ImageType>
+    Remap<ImageType> logscale (const ImageType& image, double min, double max, int cmap_size);
+
+  //! display intensities between (min, max) after histogram equalisation
+  /** This computes the histogram of the intensities in the image, and maps
+   * each intensity according to its rank, so that all colours in the
+   * colourmap are used equally often. */
+  template <class ImageType>
+    Remap<ImageType> equalise (const ImageType& image, double min, double max, int cmap_size);
+
+
+
   //! Adapter class to magnify an image
   /**
    * This makes the image `factor` bigger than the original.
@@ -208,6 +782,169 @@ namespace TG {
 
 
 
+  //! Adapter class to extract a 2D slice from a 3D volume
+  /**
+   * VolumeType can be any object that implements the following methods:
+   *     int width() const
+   *     int height() const
+   *     int depth() const
+   *     scalar_type operator() (int x, int y, int z) const
+   *
+   * `axis` specifies the axis perpendicular to the slice (0: x, 1: y, 2: z),
+   * and `index` the position of the slice along that axis. The remaining two
+   * axes are displayed in order, with the second one increasing upwards. For
+   * most medical images, this shows sagittal (axis 0), coronal (axis 1) and
+   * axial (axis 2) slices the right way up.
+   *
+   * A volume passed as an lvalue is referenced, and must outlive the slice. A
+   * temporary (e.g. the lightweight view returned by NIfTI::volume()) is
+   * instead moved into the slice, so that it cannot be left dangling. When
+   * the template argument is given explicitly, VolumeType should be a const
+   * reference type to obtain the former behaviour.
+   */
+  template <class VolumeType>
+    class slice {
+      public:
+        slice (VolumeType volume, int axis, int index);
+
+        int width () const;
+        int height () const;
+        decltype(std::declval<const VolumeType>()(0,0,0)) operator() (int x, int y) const;
+
+      private:
+        const VolumeType vol;
+        const int axis, index;
+    };
+
+
+
+  //! Adapter class to flip and/or transpose an image
+  /**
+   * This is the class returned by TG::transpose(), TG::rotate() & TG::flip(),
+   * which are more convenient to use directly.
+   *
+   * The image is first transposed (if `transpose` is set), and the result
+   * then flipped along the x and/or y axes, as requested.
+   *
+   * When the image to be reoriented is a TG::Image and a transpose is
+   * involved, the reoriented intensities are copied up front through a
+   * cache-blocked transpose, so that subsequent accesses (in row order, as
+   * performed by imshow()) are no more expensive than for the original
+   * image. Otherwise, the reorientation is performed on the fly.
+   */
+  template <class ImageType>
+    class reorient {
+      public:
+        reorient (const ImageType& image, bool transpose, bool flip_x, bool flip_y);
+
+        int width () const;
+        int height () const;
+        decltype(std::declval<const ImageType>()(0,0)) operator() (int x, int y) const;
+
+      private:
+        const ImageType& im;
+        const bool transposed, flip_x, flip_y;
+    };
+
+  template <typename ValueType>
+    class reorient<Image<ValueType>> {
+      public:
+        reorient (const Image<ValueType>& image, bool transpose, bool flip_x, bool flip_y);
+
+        int width () const;
+        int height () const;
+        const ValueType& operator() (int x, int y) const;
+
+      private:
+        const Image<ValueType>& im;
+        const bool transposed, flip_x, flip_y;
+        Image<ValueType> copy;
+    };
+
+  //! transpose the image, swapping the x & y axes
+  template <class ImageType>
+    reorient<ImageType> transpose (const ImageType& image);
+
+  //! rotate the image clockwise by `angle` degrees (must be a multiple of 90)
+  template <class ImageType>
+    reorient<ImageType> rotate (const ImageType& image, int angle);
+
+  //! flip the image along the x axis (`axis` = 0: left-right), or the y axis (`axis` = 1: top-bottom)
+  template <class ImageType>
+    reorient<ImageType> flip (const ImageType& image, int axis);
+
+
+
+  //! Adapter classes to display complex-valued images
+  /**
+   * These compute the magnitude, log-magnitude or phase of each pixel of a
+   * complex-valued image (i.e. one whose `operator()` returns a
+   * `std::complex<float>` or `std::complex<double>`) as it is accessed. They
+   * are intended to be fed to imshow() (or equivalently, TG::Rescale) to
+   * display complex data without first computing a separate real-valued
+   * image. For example:
+   *
+   *     TG::Image<std::complex<float>> kspace (256, 256);
+   *     ...
+   *     TG::imshow (TG::log_magnitude (kspace), 0, 10);
+   *     TG::imshow (TG::phase (kspace), -M_PI, M_PI, TG::jet());
+   *
+   * The log-magnitude of a zero-valued pixel is -infinity, which will be
+   * displayed as the lowest intensity in the colourmap.
+   */
+  template <class ImageType>
+    class magnitude {
+      public:
+        using value_type = typename std::remove_cvref_t<decltype(std::declval<const ImageType>()(0,0))>::value_type;
+
+        magnitude (const ImageType& image) : im (image) { }
+
+        int width () const { return im.width(); }
+        int height () const { return im.height(); }
+        value_type operator() (int x, int y) const;
+
+      private:
+        const ImageType& im;
+    };
+
+  //! Adapter class to display the log-magnitude of complex-valued images
+  /** See TG::magnitude for details. */
+  template <class ImageType>
+    class log_magnitude {
+      public:
+        using value_type = typename magnitude<ImageType>::value_type;
+
+        log_magnitude (const ImageType& image) : im (image) { }
+
+        int width () const { return im.width(); }
+        int height () const { return im.height(); }
+        value_type operator() (int x, int y) const;
+
+      private:
+        const ImageType& im;
+    };
+
+  //! Adapter class to display the phase of complex-valued images
+  /** See TG::magnitude for details. The phase is returned in radians, in
+   * the range [ -pi pi ].
+   */
+  template <class ImageType>
+    class phase {
+      public:
+        using value_type = typename magnitude<ImageType>::value_type;
+
+        phase (const ImageType& image) : im (image) { }
+
+        int width () const { return im.width(); }
+        int height () const { return im.height(); }
+        value_type operator() (int x, int y) const;
+
+      private:
+        const ImageType& im;
+    };
+
+
+
 
 
   //! Display an indexed image to the terminal, according to the colourmap supplied.
@@ -225,7 +962,17 @@ namespace TG {
    * documentation for ColourMap for details.
    */
   template <class ImageType>
-    void imshow (const ImageType& image, const ColourMap& cmap);
+    void imshow (const ImageType& image, const ColourMap& cmap, Sink& sink = default_sink());
+
+
+  //! Display a bit-packed indexed image to the terminal
+  /**
+   * This behaves exactly as imshow() for any other indexed image, but
+   * computes the sixels directly from the packed pixel data, using bitwise
+   * operations on whole words at a time.
+   */
+  template <int Bits>
+    void imshow (const PackedImage<Bits>& image, const ColourMap& cmap, Sink& sink = default_sink());
 
 
   //! Display a scalar image to the terminal, rescaled between (min, max)
@@ -248,15 +995,411 @@ namespace TG {
    * colourmaps if necessary.
    */
   template <class ImageType>
-    void imshow (const ImageType& image, double min, double max, const ColourMap& cmap = gray());
+    void imshow (const ImageType& image, double min, double max, const ColourMap& cmap = gray(),
+        Sink& sink = default_sink());
+
+
+
+  //! Compute a suitable intensity range for display
+  /**
+   * This returns the { min, max } intensity range to use to display the
+   * image supplied, suitable for use as the `min` & `max` arguments to
+   * imshow(). ImageType can be any scalar image, as expected by imshow().
+   *
+   * By default, this returns the minimum & maximum (finite) intensities in
+   * the image. If `lower` and/or `upper` are set, these are interpreted as
+   * percentiles (between 0 & 100), and the corresponding intensities are
+   * returned instead. For example, to clip the 1% darkest & brightest pixels:
+   *
+   *     const auto [ min, max ] = TG::auto_window (image, 1, 99);
+   *     TG::imshow (image, min, max);
+   *
+   * Percentiles are estimated from a histogram of the intensities (exact
+   * for integer images with fewer than 4096 distinct values), computed using
+   * multiple threads for large images. For very large images, `subsample`
+   * can be set to only consider every n-th pixel along each axis, which is
+   * normally sufficient to provide a stable estimate.
+   *
+   * If the range found is empty (e.g. for a constant image), it is widened
+   * to { v-0.5, v+0.5 } around the value v found, so that the result can
+   * always be used for display.
+   */
+  template <class ImageType>
+    std::array<double,2> auto_window (const ImageType& image,
+        double lower = 0.0, double upper = 100.0, int subsample = 1);
 
 
 
 
+  //! The data type used to hold RGB colours, with intensities between 0 & 255
+  using RGB = std::array<unsigned char,3>;
 
-  //! A class to hold the information about the font used for text rendering
+  //! Adapter class to access interleaved RGB data as an image
   /**
-   * This is should not need to be used directly outside of this file.
+   * This provides access to a buffer of interleaved RGB values (e.g. a
+   * camera frame), one byte per component, as an RGB image suitable for use
+   * with imshow(). `stride` is the number of bytes between the start of
+   * consecutive rows, if different from 3 x `width`.
+   */
+  class RGBView {
+    public:
+      RGBView (const unsigned char* data, int width, int height, int stride = 0) :
+        data (data), x_dim (width), y_dim (height), stride (stride ? stride : 3*width) { }
+
+      int width () const { return x_dim; }
+      int height () const { return y_dim; }
+      RGB operator() (int x, int y) const {
+        const unsigned char* p = data + std::size_t (y)*stride + 3*x;
+        return { p[0], p[1], p[2] };
+      }
+
+    private:
+      const unsigned char* data;
+      const int x_dim, y_dim, stride;
+  };
+
+
+
+  //! A class to map RGB colours onto the entries of a ColourMap
+  /**
+   * This holds a ColourMap of up to 256 colours, along with a lookup table
+   * that maps any RGB colour (quantised to 5 bits per component) to the
+   * index of its closest match in the ColourMap. Mapping each pixel of an
+   * RGB image then only requires a single table lookup.
+   *
+   * A Palette can be constructed from any ColourMap, for example to display
+   * a stream of RGB images using a fixed set of colours. Since the lookup
+   * table is computed once on construction, it is then only worth doing so
+   * once for the whole stream:
+   *
+   *     const TG::Palette palette = TG::Palette::uniform();
+   *     while (...) {
+   *       ...
+   *       TG::imshow (frame, palette);
+   *     }
+   *
+   * Alternatively, a suitable Palette for a given image can be generated
+   * using Palette::adaptive().
+   */
+  class Palette {
+    public:
+      //! generate a palette for the colours in the ColourMap supplied
+      explicit Palette (const ColourMap& colourmap);
+
+      //! the ColourMap for this palette
+      const ColourMap& colourmap () const { return cmap; }
+      //! the index of the ColourMap entry matching `colour`
+      ctype operator() (const RGB& colour) const {
+        return lut[((colour[0]>>3)<<10) | ((colour[1]>>3)<<5) | (colour[2]>>3)];
+      }
+
+      //! generate a palette of up to `max_colours` adapted to the image supplied
+      /**
+       * This uses the median cut algorithm on the colour histogram of (a
+       * subsample of about 64k pixels of) the image.
+       */
+      template <class ImageType>
+        static Palette adaptive (const ImageType& image, int max_colours = 256);
+
+      //! generate a palette of uniformly spaced levels of red, green & blue
+      /** The default 6 x 7 x 6 levels provide 252 colours. */
+      static Palette uniform (int red = 6, int green = 7, int blue = 6);
+
+    private:
+      ColourMap cmap;
+      std::vector<ctype> lut;
+
+      Palette () = default;
+  };
+
+
+
+  //! Display an RGB image to the terminal
+  /**
+   * ImageType can be any object that implements the following methods:
+   *     int width() const
+   *     int height() const
+   *     TG::RGB operator() (int x, int y) const
+   *
+   * such as TG::Image<TG::RGB> or TG::RGBView.
+   *
+   * Colours are mapped to the palette supplied, using multiple threads for
+   * large images.
+   */
+  template <class ImageType>
+    requires std::convertible_to<decltype(std::declval<const ImageType>()(0,0)), RGB>
+    void imshow (const ImageType& image, const Palette& palette, Sink& sink = default_sink());
+
+  //! Display an RGB image to the terminal, using an adaptive palette
+  /**
+   * This is equivalent to:
+   *
+   *     TG::imshow (image, TG::Palette::adaptive (image, max_colours));
+   */
+  template <class ImageType>
+    requires std::convertible_to<decltype(std::declval<const ImageType>()(0,0)), RGB>
+    void imshow (const ImageType& image, int max_colours = 256, Sink& sink = default_sink());
+
+
+
+
+  //! A class to display successive images progressively
+  /**
+   * Encoding and writing a large image can take a long time, particularly
+   * over a slow connection, during which nothing is shown. This class
+   * instead first displays a cheap preview of each image, downsampled by
+   * `factor` along each axis and rendered at the full size, which can be
+   * encoded and written much faster. The full resolution image is then
+   * encoded in a background thread, and written over the preview in place
+   * once ready. Successive images also replace each other in place, as for
+   * TG::InPlace. For example:
+   *
+   *     TG::Progressive display;
+   *     while (running) {
+   *       ...
+   *       display.show (image, 0, 1000);
+   *     }
+   *
+   * When displaying a scalar image, the preview is also rendered with (up to)
+   * `preview_colours` entries evenly spaced along the colourmap, which
+   * further reduces its size. Set this to zero to use the full colourmap.
+   *
+   * If a new image is shown before the previous one has been refined, the
+   * refinement is abandoned, and the new preview is written immediately: the
+   * display never falls behind by more than one image. The number of
+   * refinements abandoned in this way can be queried using cancelled().
+   *
+   * Output is written to `sink` from both the calling and the background
+   * threads, so nothing else should be written to the same sink while the
+   * object is in scope. As for TG::InPlace, set `no_scrolling` to avoid
+   * mismatches between the saved cursor position and the image if the
+   * terminal might scroll. On destruction, the refinement of the last image
+   * is completed before returning. Images are displayed using the graphics
+   * protocol in use on the current thread when the object is created (see
+   * TG::set_protocol()).
+   */
+  class Progressive {
+    public:
+      Progressive (int factor = 4, int preview_colours = 16, bool no_scrolling = false,
+          Sink& sink = default_sink());
+      ~Progressive ();
+      Progressive (const Progressive&) = delete;
+      Progressive& operator= (const Progressive&) = delete;
+
+      //! display an indexed image, as for imshow()
+      template <class ImageType>
+        void show (const ImageType& image, const ColourMap& cmap);
+
+      //! display a scalar image rescaled between (min, max), as for imshow()
+      template <class ImageType>
+        void show (const ImageType& image, double min, double max, const ColourMap& cmap = gray());
+
+      //! wait until the last image shown has been displayed at full resolution
+      void wait ();
+
+      //! the number of images whose refinement was abandoned so far
+      std::size_t cancelled () const;
+
+    private:
+      Sink& sink;
+      const int factor, preview_colours;
+      const bool no_scrolling;
+      const Protocol protocol;
+      const std::uint32_t image_id;
+
+      mutable std::mutex mutex;
+      std::condition_variable cond;
+      std::uint64_t generation, refined;
+      std::optional<Image<ctype>> job;
+      ColourMap job_cmap;
+      std::atomic<bool> cancel;
+      bool first_frame, stopping;
+      std::size_t ncancelled;
+      std::exception_ptr error;
+      std::thread worker;
+
+      void write (const std::string& image);
+      void preview (const Image<ctype>& reduced, int width, int height, const ColourMap& cmap);
+      void refine (Image<ctype>&& indices, const ColourMap& cmap);
+      void abandon ();
+      void check ();
+      void run ();
+  };
+
+
+
+
+  //! The dithering methods available for use with TG::dither()
+  /**
+   * - `Ordered` adds a position-dependent offset to each pixel (using an
+   *   8x8 Bayer matrix) before quantisation. It is very fast, and all pixels
+   *   are processed independently.
+   * - `FloydSteinberg` diffuses the quantisation error of each pixel onto
+   *   its neighbours. This gives better results, at a higher cost. Rows
+   *   are processed concurrently as a wavefront, each lagging a little
+   *   behind the row above.
+   */
+  enum class Dither { Ordered, FloydSteinberg };
+
+  //! Quantise a scalar image to colourmap indices with dithering
+  /**
+   * This plays the same role as TG::Rescale, mapping intensities between
+   * (min, max) onto the `cmap_size` indices of the colourmap, but uses
+   * dithering to avoid visible banding when the colourmap is small. It
+   * returns the resulting indexed image, which can be displayed using the
+   * same colourmap. For example:
+   *
+   *     TG::imshow (TG::dither (image, 0, 255, 8), TG::gray (8));
+   */
+  template <class ImageType>
+    Image<ctype> dither (const ImageType& image, double min, double max, int cmap_size,
+        Dither method = Dither::FloydSteinberg);
+
+  //! Quantise an RGB image to the palette supplied with dithering
+  /**
+   * This returns the indexed image, to be displayed using the palette's
+   * colourmap. For example:
+   *
+   *     const auto palette = TG::Palette::uniform (4, 4, 4);
+   *     TG::imshow (TG::dither (frame, palette), palette.colourmap());
+   */
+  template <class ImageType>
+    requires std::convertible_to<decltype(std::declval<const ImageType>()(0,0)), RGB>
+    Image<ctype> dither (const ImageType& image, const Palette& palette,
+        Dither method = Dither::FloydSteinberg);
+
+
+
+
+
+  //! Adapter class to overlay a label image onto a scalar image
+  /**
+   * This combines a scalar `image`, displayed in grayscale between (min,
+   * max) as for TG::Rescale, with an integer image of `labels`, into a
+   * single indexed image. Pixels with label n (for n between 1 and the
+   * number of entries in `label_colours`) are shown using colour
+   * `label_colours[n-1]`; all other pixels show the underlying image.
+   *
+   * The combined colourmap to use for display is partitioned into a gray
+   * ramp of `gray_levels` entries, followed by the label colours, and is
+   * available via the colourmap() method. For example:
+   *
+   *     TG::overlay seg (image, 0, 1000, labels, TG::jet (4));
+   *     TG::imshow (seg, seg.colourmap());
+   *
+   * Labels can be made partially transparent by setting `alpha` below 1:
+   * the label is then shown in that fraction of its pixels, following an
+   * 8x8 Bayer pattern, leaving the underlying image visible in between. In
+   * particular, `alpha` = 0.5 produces a checkerboard pattern.
+   *
+   * As with the other adapters, indices are computed on the fly as the
+   * image is encoded, without any intermediate image.
+   */
+  template <class ImageType, class LabelType>
+    class overlay {
+      public:
+        overlay (const ImageType& image, double min, double max, const LabelType& labels,
+            const ColourMap& label_colours, double alpha = 1.0, int gray_levels = 101);
+
+        int width () const { return base.width(); }
+        int height () const { return base.height(); }
+        ctype operator() (int x, int y) const;
+
+        //! the colourmap to use to display the overlay
+        const ColourMap& colourmap () const { return cmap; }
+
+      private:
+        const Rescale<ImageType> base;
+        const LabelType& labels;
+        const int gray_levels, nlabels, threshold;
+        ColourMap cmap;
+    };
+
+
+
+
+
+  //! A class to estimate quantiles of a stream of values in bounded memory
+  /**
+   * This implements the KLL sketch (Karnin, Lang & Liberty, 2016): values
+   * are accumulated in a hierarchy of buffers, and whenever a buffer fills
+   * up, it is sorted and every other value (starting at random) is promoted
+   * to the next level, where it stands in for twice as many values. The
+   * memory used grows only with the logarithm of the number of values, and
+   * the rank error of quantile estimates is inversely proportional to `k`
+   * (around 1% for the default `k` = 200). The minimum & maximum are tracked
+   * exactly.
+   *
+   * Sketches can be merged, so that large data sets can be processed
+   * concurrently, using one sketch per thread, and the results combined at
+   * the end; see TG::quantile_sketch(). Sketches can be displayed using
+   * Plot::add_boxplot() & Plot::add_quantile_band(). For example:
+   *
+   *     TG::QuantileSketch latency;
+   *     for (...)
+   *       latency.add (value);
+   *     std::cout << "median latency: " << latency.quantile (0.5) << "\n";
+   */
+  class QuantileSketch {
+    public:
+      QuantileSketch (int k = 200);
+
+      //! add a single value to the sketch
+      void add (double value);
+      //! merge the contents of another sketch into this one
+      void merge (const QuantileSketch& other);
+
+      //! the number of values added to the sketch
+      std::size_t count () const { return n; }
+      //! the exact minimum & maximum of the values added
+      double min () const { return minval; }
+      double max () const { return maxval; }
+
+      //! estimate the quantile `q` (between 0 & 1) of the values added
+      double quantile (double q) const;
+      //! estimate multiple quantiles at once
+      std::vector<double> quantile (const std::vector<double>& q) const;
+
+    private:
+      int k;
+      std::size_t n;
+      double minval, maxval;
+      std::uint64_t random_state;
+      std::vector<std::vector<double>> levels;
+      std::size_t retained, total_capacity;
+
+      std::size_t capacity (std::size_t level) const;
+      void compress ();
+  };
+
+  //! Compute a quantile sketch of the values supplied
+  /**
+   * The input `values` can be any class that provides `.size()` and
+   * `operator[]()` methods (e.g. `std::vector`). For large inputs, the values
+   * are processed concurrently using multiple threads, each accumulating its
+   * own sketch, which are then merged.
+   */
+  template <class ValuesType>
+    QuantileSketch quantile_sketch (const ValuesType& values, int k = 200);
+
+
+  //! Compute the histogram of the values supplied
+  /**
+   * This returns the number of values falling within each of `nbins` equal
+   * intervals spanning (min, max); values outside this range (and NaNs) are
+   * ignored. The input `values` can be any class that provides `.size()` and
+   * `operator[]()` methods (e.g. `std::vector`). Large inputs are processed
+   * concurrently using multiple threads, each accumulating its own counts.
+   */
+  template <class ValuesType>
+    std::vector<std::size_t> histogram (const ValuesType& values, double min, double max, int nbins);
+
+
+
+
+  //! A class to hold the information about the font used for text rendering
+  /**
+   * This is should not need to be used directly outside of this file.
    */
   class Font {
     public:
@@ -334,9 +1477,10 @@ namespace TG {
        *
        * If the plot has been constructed with `show_on_destruct` set to
        * `true`, this will automatically be invoked by the destructor (this is
-       * the default behaviour when using the TG::plot() function).
+       * the default behaviour when using the TG::plot() function). Any error
+       * writing to the sink is then ignored, since destructors cannot throw.
        */
-      Plot& show();
+      Plot& show (Sink& sink = default_sink());
 
       //! set the colourmap if the default is not appropriate
       Plot& set_colourmap (const ColourMap& colourmap);
@@ -395,6 +1539,109 @@ namespace TG {
       Plot& add_text (const std::string& text, float x, float y,
           float anchor_x = 0.5, float anchor_y = 0.5, int colour_index = 1);
 
+      //! add a box plot of the distribution summarised in `sketch`, centred on x
+      /** The box spans the interquartile range, with a line at the median.
+       * The whiskers extend to the `whisker` and 1-`whisker` quantiles, or
+       * to the minimum & maximum values when `whisker` is zero (the
+       * default). `width` is the width of the box, in the units of the x-axis.
+       *
+       * If the X and/or Y limits have not yet been set (using set_xlim() or
+       * set_ylim(), these will automatically be set to 10% wider than the
+       * extent of the box plot.
+       */
+      Plot& add_boxplot (float x, const QuantileSketch& sketch, float width = 0.5,
+          int colour_index = 2, float whisker = 0.0);
+
+      //! add a shaded band between the quantiles of a series of distributions
+      /** The input `sketches` can be any class that provides `.size()` and
+       * `operator[]()` methods (e.g. `std::vector`), holding a QuantileSketch
+       * for each position along the x-axis, which are placed at x = 0, 1, ...,
+       * n as for add_line(). The area between the `lower` & `upper` quantiles
+       * is filled using colour `colour_index`, and the median is drawn over
+       * it using colour `median_colour_index`.
+       *
+       * If the X and/or Y limits have not yet been set (using set_xlim() or
+       * set_ylim(), these will automatically be set to (0,n) and 10% wider
+       * than the range of the band respectively.
+       */
+      template <class SketchesType>
+        Plot& add_quantile_band (const SketchesType& sketches, float lower = 0.25, float upper = 0.75,
+            int colour_index = 7, int median_colour_index = 2);
+
+      //! add a filled polygon with vertices at (x[0],y[0]), (x[1],y[1]), ... , (x[n],y[n])
+      /** The inputs `x` & `y` can be any classes that provides `.size()` and
+       * `operator[]()` methods (e.g. `std::vector`). The polygon is closed
+       * automatically, may be self-intersecting, and is filled according to
+       * the even-odd rule using colour `colour_index`.
+       *
+       * If the X and/or Y limits have not yet been set (using set_xlim() or
+       * set_ylim(), these will automatically set them to 10% wider
+       * than the maximum range of the data in `x` & `y` respectively.
+       */
+      template <class VerticesTypeX, class VerticesTypeY>
+        Plot& add_polygon (const VerticesTypeX& x, const VerticesTypeY& y, int colour_index = 2);
+
+      //! fill the area between the data series `lower` & `upper`, plotted against `x`
+      /** This is convenient to display confidence intervals, or the area
+       * under a curve (with `lower` set to zero). The inputs can be any
+       * classes that provides `.size()` and `operator[]()` methods (e.g.
+       * `std::vector`). See add_polygon() for details.
+       */
+      template <class VerticesTypeX, class VerticesTypeLower, class VerticesTypeUpper>
+        Plot& add_band (const VerticesTypeX& x, const VerticesTypeLower& lower,
+            const VerticesTypeUpper& upper, int colour_index = 2);
+
+      //! display a scalar image within the plot axes, spanning (x0, x1) & (y0, y1)
+      /** This can be used to display a matrix, spectrogram, etc. using the
+       * coordinates of the plot. ImageType can be any scalar image, as
+       * expected by imshow(), and its intensities are rescaled between (min,
+       * max) using `colourmap`. As for imshow(), the first row of the image
+       * is displayed at the top (use TG::flip() to reverse this).
+       *
+       * The colourmap is appended to the plot's own colourmap (unless already
+       * present), so that the plot and the image are encoded together as a
+       * single image; the combined colourmap cannot exceed 256 entries. The
+       * image is resampled to the display by nearest neighbour, using tables
+       * of the image row & column corresponding to each row & column of
+       * pixels, computed up front.
+       *
+       * If the X and/or Y limits have not yet been set (using set_xlim() or
+       * set_ylim(), these will automatically be set to the extent of the
+       * image.
+       */
+      template <class ImageType>
+        Plot& add_image (const ImageType& image, float x0, float y0, float x1, float y1,
+            double min, double max, const ColourMap& colourmap = gray());
+
+      //! add a bar chart of the data series `heights`
+      /** The input `heights` can be any class that provides `.size()` and
+       * `operator[]()` methods (e.g. `std::vector`). Bar n spans the interval
+       * (x0 + n*width, x0 + (n+1)*width) along the x-axis, and extends from
+       * zero to `heights[n]`, filled using colour `colour_index`.
+       *
+       * If the X and/or Y limits have not yet been set (using set_xlim() or
+       * set_ylim(), these will automatically be set to the extent of the bars
+       * and 10% wider than the range of the bars (including zero)
+       * respectively.
+       */
+      template <class VerticesType>
+        Plot& add_bars (const VerticesType& heights, float x0 = 0.0, float width = 1.0,
+            int colour_index = 2);
+
+      //! add a histogram of the values supplied, using `nbins` bins spanning (min, max)
+      /** See TG::histogram() for details. The histogram is displayed using
+       * add_bars().
+       */
+      template <class ValuesType>
+        Plot& add_histogram (const ValuesType& values, float min, float max, int nbins = 50,
+            int colour_index = 2);
+
+      //! add a histogram of the values supplied, spanning their full range
+      /** This is named differently from add_histogram(), since a call such
+       * as `add_histogram (values, 0, 10)` would otherwise be ambiguous. */
+      template <class ValuesType>
+        Plot& add_histogram_auto (const ValuesType& values, int nbins = 50, int colour_index = 2);
+
       //! set the range along the x-axis
       /** Note that this can only be done once, and if required, should be
        * invoked before any rendering commands.
@@ -421,8 +1668,12 @@ namespace TG {
         static void line_x (ImageType& canvas, float x0, float y0, float x1, float y1,
             int colour_index, int stiple, float stiple_frac);
 
+      void fill_span (int y, int x0, int x1, int colour_index);
+      void fill_polygon (const std::vector<std::array<float,2>>& vertices, int colour_index);
       float mapx (float x) const;
       float mapy (float y) const;
+
+      template <class VolumeType> friend class OrthoView;
   };
 
   //! Convenience function to use for immediate rendering
@@ -449,6 +1700,63 @@ namespace TG {
 
 
 
+  //! A class to display orthogonal slices through a volume
+  /**
+   * This renders the axial, coronal and sagittal planes through the cursor
+   * position side by side (in that order), with crosshairs marking the cursor
+   * location, and displays them as a single image. VolumeType can be any
+   * object that provides the methods expected by TG::slice.
+   *
+   * Each plane is rescaled between (min, max) using the colourmap supplied
+   * (gray by default). The crosshairs are drawn using an additional colour
+   * appended to the colourmap, set to yellow by default.
+   *
+   * The rendered planes are retained between calls to show(), so that
+   * moving the cursor only re-renders those planes whose slice position has
+   * actually changed. For example:
+   *
+   *     TG::OrthoView view (volume, 0, 1000);
+   *     view.set_cursor (64, 64, 40).show();
+   *     view.set_cursor (64, 64, 41).show();   // only the axial plane is re-rendered
+   *
+   * As for TG::slice, the volume is referenced if passed as an lvalue, and
+   * moved into the view if passed as a temporary.
+   */
+  template <class VolumeType>
+    class OrthoView {
+      public:
+        OrthoView (VolumeType volume, double min, double max, const ColourMap& cmap = gray());
+
+        //! set the cursor position, in voxel coordinates
+        OrthoView& set_cursor (int x, int y, int z);
+        //! set the colour used to render the crosshairs
+        OrthoView& set_crosshair_colour (const std::array<ctype,3>& colour);
+        //! display the current view to the terminal
+        OrthoView& show (Sink& sink = default_sink());
+
+      private:
+        const VolumeType vol;
+        const double min, max;
+        ColourMap cmap;
+        std::array<int,3> cursor;
+        std::array<Image<ctype>,3> planes;
+        std::array<int,3> rendered;
+        std::array<int,3> offset;
+        Image<ctype> canvas;
+
+        void render_plane (int n);
+        void draw_crosshairs (int n);
+    };
+
+  //! Convenience function to display orthogonal slices through the cursor position
+  /** See TG::OrthoView for details. */
+  template <class VolumeType>
+    void orthoview (const VolumeType& volume, int x, int y, int z,
+        double min, double max, const ColourMap& cmap = gray(), Sink& sink = default_sink());
+
+
+
+
 
 
 
@@ -470,50 +1778,131 @@ namespace TG {
   // **************************************************************************
 
   namespace {
-    inline ctype clamp (float val, int number) {
-      return ctype (std::round (std::min (std::max ((100.0/number)*val, 0.0), static_cast<double>(number))));
+    constexpr ctype clamp (double val, int number) {
+      // equivalent to std::round(), which is not constexpr:
+      return ctype (std::min (std::max ((100.0/number)*val, 0.0), 100.0) + 0.5);
     }
-  }
 
+    constexpr int iabs (int val) { return val < 0 ? -val : val; }
 
-  inline ColourMap gray (int number)
-  {
-    ColourMap cmap (number);
-    for (int n = 0; n < number; ++n) {
-      ctype c = clamp (n, number-1);
-      cmap[n] = { c, c, c };
-    }
-    return cmap;
-  }
+    // functions to compute entry n of a colourmap with the specified number of entries:
 
+    constexpr std::array<ctype,3> gray_entry (int n, int number)
+    {
+      const ctype c = clamp (n, number-1);
+      return { c, c, c };
+    }
 
-  inline ColourMap hot (int number)
-  {
-    ColourMap cmap (number);
-    for (int n = 0; n < number; ++n) {
-      cmap[n] = {
+    constexpr std::array<ctype,3> hot_entry (int n, int number)
+    {
+      return {
         clamp (3*n, number-1),
         clamp (3*n-number, number-1),
         clamp (3*n-2*number, number-1)
       };
     }
+
+    constexpr std::array<ctype,3> jet_entry (int n, int number)
+    {
+      return {
+        clamp (1.5*number-iabs(4*n-3*number), number-1),
+        clamp (1.5*number-iabs(4*n-2*number), number-1),
+        clamp (1.5*number-iabs(4*n-1*number), number-1)
+      };
+    }
+
+    constexpr std::array<ctype,3> viridis_entry (int n, int number)
+    {
+      // polynomial fit to the original viridis colourmap, from:
+      // https://www.shadertoy.com/view/WlfXRN
+      constexpr std::array<std::array<double,3>,7> coefs = {{
+        {  0.2777273272234177,  0.005407344544966578,  0.3340998053353061 },
+        {  0.1050930431085774,  1.404613529898575,     1.384590162594685  },
+        { -0.3308618287255563,  0.214847559468213,     0.09509516302823659 },
+        { -4.634230498983486,  -5.799100973351585,   -19.33244095627987   },
+        {  6.228269936347081,  14.17993336680509,     56.69055260068105   },
+        {  4.776384997670288, -13.74514537774601,    -65.35303263337234   },
+        { -5.435455855934631,   4.645852612178535,    26.3124352495832    }
+      }};
+      const double t = number > 1 ? double (n) / (number-1) : 0.0;
+      std::array<ctype,3> c;
+      for (int i = 0; i < 3; ++i) {
+        double val = 0.0;
+        for (int k = 6; k >= 0; --k)
+          val = val*t + coefs[k][i];
+        c[i] = clamp (val, 1);
+      }
+      return c;
+    }
+
+
+
+    constexpr int default_colourmap_size = 101;
+
+    template <class Generator>
+      constexpr std::array<std::array<ctype,3>,default_colourmap_size> colourmap_table (Generator entry)
+      {
+        std::array<std::array<ctype,3>,default_colourmap_size> table;
+        for (int n = 0; n < default_colourmap_size; ++n)
+          table[n] = entry (n, default_colourmap_size);
+        return table;
+      }
+
+    template <class Generator>
+      inline ColourMap colourmap (int number, Generator entry)
+      {
+        ColourMap cmap (number);
+        for (int n = 0; n < number; ++n)
+          cmap[n] = entry (n, number);
+        return cmap;
+      }
+
+    constexpr auto gray_table = colourmap_table (gray_entry);
+    constexpr auto hot_table = colourmap_table (hot_entry);
+    constexpr auto jet_table = colourmap_table (jet_entry);
+    constexpr auto viridis_table = colourmap_table (viridis_entry);
+  }
+
+
+
+  inline const ColourMap& gray ()
+  {
+    static const ColourMap cmap (gray_table.begin(), gray_table.end());
     return cmap;
   }
 
+  inline ColourMap gray (int number) { return colourmap (number, gray_entry); }
 
-  inline ColourMap jet (int number)
+
+
+  inline const ColourMap& hot ()
   {
-    ColourMap cmap (number);
-    for (int n = 0; n < number; ++n) {
-      cmap[n] = {
-        clamp (1.5*number-std::abs(4*n-3*number), number-1),
-        clamp (1.5*number-std::abs(4*n-2*number), number-1),
-        clamp (1.5*number-std::abs(4*n-1*number), number-1)
-      };
-    }
+    static const ColourMap cmap (hot_table.begin(), hot_table.end());
     return cmap;
   }
 
+  inline ColourMap hot (int number) { return colourmap (number, hot_entry); }
+
+
+
+  inline const ColourMap& jet ()
+  {
+    static const ColourMap cmap (jet_table.begin(), jet_table.end());
+    return cmap;
+  }
+
+  inline ColourMap jet (int number) { return colourmap (number, jet_entry); }
+
+
+
+  inline const ColourMap& viridis ()
+  {
+    static const ColourMap cmap (viridis_table.begin(), viridis_table.end());
+    return cmap;
+  }
+
+  inline ColourMap viridis (int number) { return colourmap (number, viridis_entry); }
+
 
 
 
@@ -525,7 +1914,7 @@ namespace TG {
 
   template <typename ValueType>
     inline Image<ValueType>::Image (int x_dim, int y_dim) :
-      data (x_dim*y_dim, 0),
+      data (x_dim*y_dim, ValueType {}),
       x_dim (x_dim),
       y_dim (y_dim) { }
 
@@ -558,7 +1947,7 @@ namespace TG {
     inline void Image<ValueType>::clear ()
     {
       for (auto& x : data)
-        x = 0;
+        x = ValueType {};
     }
 
 
@@ -568,162 +1957,2555 @@ namespace TG {
 
 
   // **************************************************************************
-  //                   Rescale implementation
+  //                   PackedImage class implementation
   // **************************************************************************
 
-  template <class ImageType>
-    inline Rescale<ImageType>::Rescale (const ImageType& image, double minval, double maxval, int cmap_size) :
-      im (image), min (minval), max (maxval), cmap_size (cmap_size) { }
 
-  template <class ImageType>
-    inline int Rescale<ImageType>::width () const { return im.width(); }
 
-  template <class ImageType>
-    inline int Rescale<ImageType>::height () const { return im.height(); }
+  template <int Bits>
+    inline PackedImage<Bits>::PackedImage (int x_dim, int y_dim) :
+      x_dim (x_dim),
+      y_dim (y_dim),
+      stride ((x_dim + pixels_per_word - 1) / pixels_per_word),
+      data (std::size_t (stride) * y_dim, 0) { }
+
+  template <int Bits>
+    inline int PackedImage<Bits>::width () const
+    {
+      return x_dim;
+    }
+
+  template <int Bits>
+    inline int PackedImage<Bits>::height () const
+    {
+      return y_dim;
+    }
+
+  template <int Bits>
+    inline typename PackedImage<Bits>::reference PackedImage<Bits>::operator() (int x, int y)
+    {
+      return { data[x/pixels_per_word + std::size_t (stride)*y], (x%pixels_per_word)*Bits };
+    }
+
+  template <int Bits>
+    inline ctype PackedImage<Bits>::operator() (int x, int y) const
+    {
+      return (data[x/pixels_per_word + std::size_t (stride)*y] >> ((x%pixels_per_word)*Bits)) & mask;
+    }
+
+  template <int Bits>
+    inline const typename PackedImage<Bits>::word_type* PackedImage<Bits>::row (int y) const
+    {
+      return data.data() + std::size_t (stride)*y;
+    }
+
+  template <int Bits>
+    inline typename PackedImage<Bits>::reference& PackedImage<Bits>::reference::operator= (ctype value)
+    {
+      word = (word & ~(mask << shift)) | (word_type (value & mask) << shift);
+      return *this;
+    }
+
+  template <int Bits>
+    inline void PackedImage<Bits>::clear ()
+    {
+      std::fill (data.begin(), data.end(), 0);
+    }
+
+
+
+
+
+
+
+  // **************************************************************************
+  //                   Rescale implementation
+  // **************************************************************************
+
+  template <class ImageType>
+    inline Rescale<ImageType>::Rescale (const ImageType& image, double minval, double maxval, int cmap_size) :
+      im (image), min (minval), max (maxval), cmap_size (cmap_size) { }
+
+  template <class ImageType>
+    inline int Rescale<ImageType>::width () const { return im.width(); }
+
+  template <class ImageType>
+    inline int Rescale<ImageType>::height () const { return im.height(); }
+
+  template <class ImageType>
+    inline ctype Rescale<ImageType>::operator() (int x, int y) const {
+      double rescaled = cmap_size * (im(x,y) - min) / (max - min);
+      return std::round (std::min (std::max (rescaled, 0.0), cmap_size-1.0));
+    }
+
+
+
+  // **************************************************************************
+  //                   magnify implementation
+  // **************************************************************************
+
+  template <class ImageType>
+    inline magnify<ImageType>::magnify (const ImageType& image, int factor) :
+      im (image), factor (factor) { }
+
+  template <class ImageType>
+    inline int magnify<ImageType>::width () const { return im.width() * factor; }
+
+  template <class ImageType>
+    inline int magnify<ImageType>::height () const { return im.height() * factor; }
+
+  template <class ImageType>
+    inline decltype(std::declval<const ImageType>()(0,0)) magnify<ImageType>::operator() (int x, int y) const {
+      return im (x/factor, y/factor);
+    }
+
+
+
+  // **************************************************************************
+  //                   slice implementation
+  // **************************************************************************
+
+  namespace {
+    // how a volume is held by TG::slice & TG::OrthoView: by const reference
+    // if it is an lvalue, by value if it is a temporary:
+    template <class VolumeType>
+      using held_volume_t = std::conditional_t<std::is_lvalue_reference_v<VolumeType>,
+            const std::remove_reference_t<VolumeType>&, std::remove_cvref_t<VolumeType>>;
+  }
+
+  template <class VolumeType>
+    slice (VolumeType&&, int, int) -> slice<held_volume_t<VolumeType>>;
+
+  template <class VolumeType>
+    inline slice<VolumeType>::slice (VolumeType volume, int axis, int index) :
+      vol (std::forward<VolumeType> (volume)), axis (axis), index (index)
+    {
+      const int size = axis == 0 ? vol.width() : ( axis == 1 ? vol.height() : vol.depth() );
+      if (axis < 0 || axis > 2)
+        throw std::runtime_error (std::format ("invalid slice axis {}", axis));
+      if (index < 0 || index >= size)
+        throw std::runtime_error (std::format ("slice index {} out of range along axis {}", index, axis));
+    }
+
+  template <class VolumeType>
+    inline int slice<VolumeType>::width () const { return axis == 0 ? vol.height() : vol.width(); }
+
+  template <class VolumeType>
+    inline int slice<VolumeType>::height () const { return axis == 2 ? vol.height() : vol.depth(); }
+
+  template <class VolumeType>
+    inline decltype(std::declval<const VolumeType>()(0,0,0)) slice<VolumeType>::operator() (int x, int y) const {
+      y = height()-1-y;
+      switch (axis) {
+        case 0: return vol (index, x, y);
+        case 1: return vol (x, index, y);
+        default: return vol (x, y, index);
+      }
+    }
+
+
+
+  // **************************************************************************
+  //                   reorient implementation
+  // **************************************************************************
+
+  template <class ImageType>
+    inline reorient<ImageType>::reorient (const ImageType& image, bool transpose, bool flip_x, bool flip_y) :
+      im (image), transposed (transpose), flip_x (flip_x), flip_y (flip_y) { }
+
+  template <class ImageType>
+    inline int reorient<ImageType>::width () const { return transposed ? im.height() : im.width(); }
+
+  template <class ImageType>
+    inline int reorient<ImageType>::height () const { return transposed ? im.width() : im.height(); }
+
+  template <class ImageType>
+    inline decltype(std::declval<const ImageType>()(0,0)) reorient<ImageType>::operator() (int x, int y) const {
+      if (flip_x) x = width()-1-x;
+      if (flip_y) y = height()-1-y;
+      return transposed ? im (y,x) : im (x,y);
+    }
+
+
+
+
+  template <typename ValueType>
+    inline reorient<Image<ValueType>>::reorient (const Image<ValueType>& image, bool transpose, bool flip_x, bool flip_y) :
+      im (image), transposed (transpose), flip_x (flip_x), flip_y (flip_y),
+      copy (transpose ? image.height() : 0, transpose ? image.width() : 0)
+    {
+      if (!transposed)
+        return;
+
+      // copy through tiles small enough to remain cache-resident, so that
+      // both the reads & the writes are contiguous over several pixels:
+      constexpr int tile = 32;
+      const int x_dim = copy.width(), y_dim = copy.height();
+      for (int y0 = 0; y0 < y_dim; y0 += tile) {
+        for (int x0 = 0; x0 < x_dim; x0 += tile) {
+          const int x1 = std::min (x0+tile, x_dim), y1 = std::min (y0+tile, y_dim);
+          for (int x = x0; x < x1; ++x) {
+            const int sy = flip_x ? x_dim-1-x : x;
+            for (int y = y0; y < y1; ++y)
+              copy(x,y) = im (flip_y ? y_dim-1-y : y, sy);
+          }
+        }
+      }
+    }
+
+  template <typename ValueType>
+    inline int reorient<Image<ValueType>>::width () const { return transposed ? im.height() : im.width(); }
+
+  template <typename ValueType>
+    inline int reorient<Image<ValueType>>::height () const { return transposed ? im.width() : im.height(); }
+
+  template <typename ValueType>
+    inline const ValueType& reorient<Image<ValueType>>::operator() (int x, int y) const {
+      if (transposed)
+        return copy (x,y);
+      if (flip_x) x = width()-1-x;
+      if (flip_y) y = height()-1-y;
+      return im (x,y);
+    }
+
+
+
+
+  template <class ImageType>
+    inline reorient<ImageType> transpose (const ImageType& image)
+    {
+      return { image, true, false, false };
+    }
+
+  template <class ImageType>
+    inline reorient<ImageType> rotate (const ImageType& image, int angle)
+    {
+      switch (((angle % 360) + 360) % 360) {
+        case 0:   return { image, false, false, false };
+        case 90:  return { image, true, true, false };
+        case 180: return { image, false, true, true };
+        case 270: return { image, true, false, true };
+        default: throw std::runtime_error (std::format ("rotation angle {} is not a multiple of 90 degrees", angle));
+      }
+    }
+
+  template <class ImageType>
+    inline reorient<ImageType> flip (const ImageType& image, int axis)
+    {
+      if (axis < 0 || axis > 1)
+        throw std::runtime_error (std::format ("invalid flip axis {}", axis));
+      return { image, false, axis == 0, axis == 1 };
+    }
+
+
+
+  // **************************************************************************
+  //                   complex adapters implementation
+  // **************************************************************************
+
+  // These avoid std::abs() & std::log() on the complex value, which guard
+  // against overflow at the expense of much slower (and non-vectorisable)
+  // code. This is not a concern for display purposes.
+
+  template <class ImageType>
+    inline typename magnitude<ImageType>::value_type magnitude<ImageType>::operator() (int x, int y) const {
+      const auto c = im(x,y);
+      return std::sqrt (c.real()*c.real() + c.imag()*c.imag());
+    }
+
+  template <class ImageType>
+    inline typename log_magnitude<ImageType>::value_type log_magnitude<ImageType>::operator() (int x, int y) const {
+      const auto c = im(x,y);
+      return value_type (0.5) * std::log (c.real()*c.real() + c.imag()*c.imag());
+    }
+
+  template <class ImageType>
+    inline typename phase<ImageType>::value_type phase<ImageType>::operator() (int x, int y) const {
+      const auto c = im(x,y);
+      return std::atan2 (c.imag(), c.real());
+    }
+
+
+
+
+  // **************************************************************************
+  //                   Sink implementation
+  // **************************************************************************
+
+  inline void StreamSink::write (std::span<const std::string_view> buffers)
+  {
+    for (const auto& b : buffers)
+      stream.write (b.data(), b.size());
+    stream.flush();
+  }
+
+  inline bool StreamSink::writes_to_terminal () const
+  {
+#if defined(__unix__) || defined(__APPLE__)
+    if (&stream == &std::cout)
+      return ::isatty (STDOUT_FILENO);
+    if (&stream == &std::cerr || &stream == &std::clog)
+      return ::isatty (STDERR_FILENO);
+#endif
+    return false;
+  }
+
+#if defined(__unix__) || defined(__APPLE__)
+  inline void FileSink::write (std::span<const std::string_view> buffers)
+  {
+    std::vector<iovec> iov;
+    for (const auto& b : buffers)
+      if (b.size())
+        iov.push_back ({ const_cast<char*> (b.data()), b.size() });
+
+    // writev() may write only part of the data, in which case we resume
+    // from where it left off:
+    std::size_t n = 0;
+    while (n < iov.size()) {
+      const int count = std::min (iov.size()-n, std::size_t (IOV_MAX));
+      const ssize_t written = ::writev (fd, iov.data()+n, count);
+      if (written < 0) {
+        if (errno == EINTR)
+          continue;
+        throw std::runtime_error (std::format ("error writing image to file descriptor {}: {}", fd, std::strerror (errno)));
+      }
+      std::size_t remaining = written;
+      while (n < iov.size() && remaining >= iov[n].iov_len)
+        remaining -= iov[n++].iov_len;
+      if (remaining) {
+        iov[n].iov_base = static_cast<char*> (iov[n].iov_base) + remaining;
+        iov[n].iov_len -= remaining;
+      }
+    }
+  }
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+  inline NonBlockingSink::NonBlockingSink (int fd) :
+    fd (fd),
+    original_flags (::fcntl (fd, F_GETFL)),
+    offset (0),
+    queued_begin (0),
+    queued_end (0),
+    ndropped (0)
+  {
+    if (original_flags < 0 || ::fcntl (fd, F_SETFL, original_flags | O_NONBLOCK) < 0)
+      throw std::runtime_error (std::format ("unable to set file descriptor {} to non-blocking mode: {}", fd, std::strerror (errno)));
+  }
+
+  inline NonBlockingSink::~NonBlockingSink ()
+  {
+    try { flush(); }
+    catch (...) { }
+    ::fcntl (fd, F_SETFL, original_flags);
+  }
+
+
+  // write as much of the buffers as possible without blocking, returning
+  // the number of bytes written. On return, `iov` describes the data that
+  // remain to be written.
+  inline std::size_t NonBlockingSink::write_some (std::vector<iovec>& iov)
+  {
+    std::size_t total = 0, n = 0;
+    while (n < iov.size()) {
+      const int count = std::min (iov.size()-n, std::size_t (IOV_MAX));
+      const ssize_t written = ::writev (fd, iov.data()+n, count);
+      if (written < 0) {
+        if (errno == EINTR)
+          continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+          break;
+        throw std::runtime_error (std::format ("error writing image to file descriptor {}: {}", fd, std::strerror (errno)));
+      }
+      total += written;
+      std::size_t remaining = written;
+      while (n < iov.size() && remaining >= iov[n].iov_len) {
+        remaining -= iov[n].iov_len;
+        iov[n++].iov_len = 0;
+      }
+      if (remaining) {
+        iov[n].iov_base = static_cast<char*> (iov[n].iov_base) + remaining;
+        iov[n].iov_len -= remaining;
+      }
+    }
+    return total;
+  }
+
+
+  // write as much of the current image as possible, then move on to the
+  // queued image (if any) once the current one is complete:
+  inline void NonBlockingSink::progress ()
+  {
+    while (current.size()) {
+      std::vector<iovec> iov = { { current.data()+offset, current.size()-offset } };
+      offset += write_some (iov);
+      if (offset < current.size())
+        return;
+      current.clear();
+      offset = 0;
+      std::swap (current, queued);
+      queued_begin = queued_end = 0;
+    }
+  }
+
+
+  inline void NonBlockingSink::write (std::span<const std::string_view> buffers)
+  {
+    progress();
+
+    if (busy()) {
+      // replace the queued image (if any), retaining any control data:
+      if (queued_end > queued_begin) {
+        queued.erase (queued_begin, queued_end - queued_begin);
+        ++ndropped;
+      }
+      queued_begin = queued.size();
+      for (const auto& b : buffers)
+        queued += b;
+      queued_end = queued.size();
+      return;
+    }
+
+    write_now (buffers);
+  }
+
+
+  inline void NonBlockingSink::write_control (std::string_view data)
+  {
+    progress();
+
+    if (busy())
+      queued += data;
+    else
+      write_now (std::span (&data, 1));
+  }
+
+
+  // nothing pending: write directly from the buffers supplied, and only
+  // retain whatever could not be written immediately:
+  inline void NonBlockingSink::write_now (std::span<const std::string_view> buffers)
+  {
+    std::vector<iovec> iov;
+    for (const auto& b : buffers)
+      if (b.size())
+        iov.push_back ({ const_cast<char*> (b.data()), b.size() });
+    write_some (iov);
+    for (const auto& v : iov)
+      current.append (static_cast<const char*> (v.iov_base), v.iov_len);
+  }
+
+
+  inline bool NonBlockingSink::flush (int timeout)
+  {
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds (timeout);
+    while (true) {
+      progress();
+      if (!busy())
+        return true;
+
+      int remaining = -1;
+      if (timeout >= 0) {
+        remaining = std::chrono::ceil<std::chrono::milliseconds> (deadline - std::chrono::steady_clock::now()).count();
+        if (remaining <= 0)
+          return false;
+      }
+      pollfd p = { fd, POLLOUT, 0 };
+      if (::poll (&p, 1, remaining) < 0 && errno != EINTR)
+        throw std::runtime_error (std::format ("error waiting on file descriptor {}: {}", fd, std::strerror (errno)));
+    }
+  }
+#endif
+
+  inline void BufferSink::write (std::span<const std::string_view> buffers)
+  {
+    for (const auto& b : buffers)
+      data += b;
+  }
+
+  inline void CallbackSink::write (std::span<const std::string_view> buffers)
+  {
+    for (const auto& b : buffers)
+      callback (b);
+  }
+
+
+
+  inline ConcurrentSink::ConcurrentSink (Sink& target) :
+    target (target),
+    head (nullptr),
+    submitted (0),
+    written (0),
+    failed (false),
+    writer ([this] { run(); }) { }
+
+  inline ConcurrentSink::~ConcurrentSink ()
+  {
+    // the writer stops once it reaches the stop node, after writing all
+    // images submitted before it:
+    push (&stop);
+    writer.join();
+  }
+
+
+  // producers push onto the head of an intrusive singly-linked list (a
+  // Treiber stack), which only ever needs a single compare-and-swap:
+  inline void ConcurrentSink::push (Node* node)
+  {
+    node->next = head.load (std::memory_order_relaxed);
+    while (!head.compare_exchange_weak (node->next, node, std::memory_order_release, std::memory_order_relaxed));
+    head.notify_one();
+  }
+
+
+  inline void ConcurrentSink::write (std::span<const std::string_view> buffers)
+  {
+    check();
+    Node* node = new Node { nullptr, { } };
+    for (const auto& b : buffers)
+      node->data += b;
+    submitted.fetch_add (1, std::memory_order_relaxed);
+    push (node);
+  }
+
+
+  inline void ConcurrentSink::write_control (std::string_view data)
+  {
+    check();
+    submitted.fetch_add (1, std::memory_order_relaxed);
+    push (new Node { nullptr, std::string (data), true });
+  }
+
+
+  inline void ConcurrentSink::flush ()
+  {
+    const auto target_count = submitted.load();
+    for (auto n = written.load(); n < target_count; n = written.load())
+      written.wait (n);
+    check();
+  }
+
+
+  inline void ConcurrentSink::check ()
+  {
+    if (failed.load (std::memory_order_acquire))
+      std::rethrow_exception (error);
+  }
+
+
+  // the single consumer takes the whole list in one go, and reverses it to
+  // recover submission order. Once the target sink has failed, any further
+  // images are discarded:
+  inline void ConcurrentSink::run ()
+  {
+    while (true) {
+      head.wait (nullptr, std::memory_order_acquire);
+      Node* list = head.exchange (nullptr, std::memory_order_acquire);
+
+      Node* ordered = nullptr;
+      while (list) {
+        Node* next = list->next;
+        list->next = ordered;
+        ordered = list;
+        list = next;
+      }
+
+      while (ordered) {
+        Node* node = ordered;
+        ordered = node->next;
+        if (node == &stop)
+          return;
+        if (!failed.load (std::memory_order_relaxed)) {
+          try {
+            if (node->control)
+              target.write_control (node->data);
+            else
+              target.write (node->data);
+          }
+          catch (...) {
+            error = std::current_exception();
+            failed.store (true, std::memory_order_release);
+          }
+        }
+        delete node;
+        written.fetch_add (1, std::memory_order_release);
+        written.notify_all();
+      }
+    }
+  }
+
+
+
+  // sink set by set_default_sink() for the current thread. Declared inline
+  // rather than in the anonymous namespace so that it is shared by all
+  // translation units:
+  inline thread_local Sink* current_sink = nullptr;
+
+  // likewise for the protocol set by set_protocol():
+  inline thread_local Protocol current_protocol = Protocol::Sixel;
+
+  inline ConcurrentSink& display_channel ()
+  {
+    static StreamSink stdout_sink (std::cout);
+    static ConcurrentSink channel (stdout_sink);
+    return channel;
+  }
+
+  inline Sink& default_sink ()
+  {
+    static StreamSink stdout_sink (std::cout);
+    return current_sink ? *current_sink : stdout_sink;
+  }
+
+  inline void set_default_sink (Sink* sink)
+  {
+    current_sink = sink;
+  }
+
+  inline void set_protocol (Protocol protocol)
+  {
+    current_protocol = protocol;
+  }
+
+  inline Protocol get_protocol ()
+  {
+    return current_protocol;
+  }
+
+
+
+
+
+
+
+  // **************************************************************************
+  //                   imshow implementation
+  // **************************************************************************
+
+
+
+
+  // state of in-place display mode for the current thread, managed by
+  // TG::InPlace. Per-thread state must be shared by all translation units,
+  // so is declared inline rather than in the anonymous namespace:
+  struct InPlaceState {
+    bool active = false;
+    bool no_scrolling = false;
+    bool first_frame = true;
+    std::uint32_t image_id = 0;
+  };
+  inline thread_local InPlaceState in_place_state;
+
+  // the next image ID to use with the kitty graphics protocol. IDs apply to
+  // the whole terminal, so start from a random value to avoid clashing with
+  // other processes:
+  inline std::atomic<std::uint32_t> next_kitty_image_id (std::random_device{}());
+
+  // a new non-zero image ID, to refer to the images displayed in place by
+  // the same TG::InPlace or TG::Progressive object:
+  inline std::uint32_t new_kitty_image_id ()
+  {
+    std::uint32_t id;
+    while ((id = next_kitty_image_id.fetch_add (1, std::memory_order_relaxed)) == 0);
+    return id;
+  }
+
+  // counter used to generate unique names for kitty shared memory objects:
+  inline std::atomic<unsigned int> kitty_shared_memory_counter (0);
+
+  // the FrameCache in use for the current thread, if any (likewise shared by
+  // all translation units):
+  inline thread_local FrameCache* active_frame_cache = nullptr;
+
+
+
+
+  // functions in anonymous namespace will remain private to this file:
+  namespace {
+
+    // helper functions for colourmap handling:
+
+    inline const std::string& colourmap_specifier (const ColourMap& colours)
+    {
+      // Formatting the specifier is relatively expensive, and the same few
+      // colourmaps tend to be used repeatedly. Keep the most recently used
+      // specifiers, identified by the contents of the colourmap:
+      thread_local std::vector<std::pair<ColourMap,std::string>> cache;
+      constexpr std::size_t cache_size = 8;
+
+      auto entry = std::ranges::find (cache, colours, &std::pair<ColourMap,std::string>::first);
+      if (entry == cache.end()) {
+        int n = 0;
+        std::string specifier;
+        for (const auto& c : colours)
+          specifier += std::format ("#{};2;{};{};{}",
+              n++, static_cast<int>(c[0]), static_cast<int>(c[1]),static_cast<int>(c[2]));
+        if (cache.size() >= cache_size)
+          cache.pop_back();
+        cache.emplace_back (colours, std::move (specifier));
+        entry = cache.end()-1;
+      }
+
+      // move most recently used entry to the front:
+      std::rotate (cache.begin(), entry, entry+1);
+      return cache.front().second;
+    }
+
+
+
+
+    // send the fully encoded image to the sink, preceded by the escape
+    // sequences required for in-place display if active:
+    inline void display (const std::string& image, Sink& sink)
+    {
+      if (!in_place_state.active) {
+        sink.write (image);
+        return;
+      }
+      const std::array<std::string_view,2> buffers = {
+        in_place_state.first_frame ? (in_place_state.no_scrolling ? "\033[?80h\0337" : "\0337") : "\0338",
+        image
+      };
+      in_place_state.first_frame = false;
+      sink.write (buffers);
+    }
+
+
+
+
+    // helper functions for the kitty graphics protocol:
+
+    inline void base64_encode (std::string& out, const unsigned char* data, std::size_t size)
+    {
+      constexpr char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+      out.reserve (out.size() + 4*((size+2)/3));
+      std::size_t n = 0;
+      for (; n+2 < size; n += 3) {
+        const std::uint32_t v = data[n]<<16 | data[n+1]<<8 | data[n+2];
+        out += { digits[v>>18], digits[(v>>12)&63U], digits[(v>>6)&63U], digits[v&63U] };
+      }
+      if (n < size) {
+        const std::uint32_t v = data[n]<<16 | (n+1 < size ? data[n+1]<<8 : 0);
+        out += { digits[v>>18], digits[(v>>12)&63U], n+1 < size ? digits[(v>>6)&63U] : '=', '=' };
+      }
+    }
+
+
+    // shared memory can only be used if the terminal runs on the same
+    // system, which is assumed unless logged in via SSH. The output then
+    // refers to a shared memory object that only the terminal removes, once
+    // read. To avoid leaking these objects, this is restricted to terminals
+    // known to support it, and to sinks that never discard any output:
+    inline bool kitty_shared_memory ([[maybe_unused]] const Sink& sink)
+    {
+#if defined(__unix__) || defined(__APPLE__)
+      auto env = [] (const char* name) { const char* value = std::getenv (name); return std::string_view (value ? value : ""); };
+      static const bool local = env ("SSH_CONNECTION").empty() && env ("SSH_CLIENT").empty() && env ("SSH_TTY").empty();
+      static const bool supported = env ("KITTY_WINDOW_ID").size() || env ("TERM") == "xterm-kitty" || env ("TERM_PROGRAM") == "ghostty";
+      return current_protocol == Protocol::Kitty && local && supported && sink.writes_to_terminal();
+#else
+      return false;
+#endif
+    }
+
+
+#if defined(__unix__) || defined(__APPLE__)
+    // copy the data into a new shared memory object, and return its name (or
+    // an empty string on failure):
+    inline std::string kitty_shared_memory_object (const std::vector<unsigned char>& data)
+    {
+      const std::string name = std::format ("/tg-{}-{}", ::getpid(), kitty_shared_memory_counter++);
+      const int fd = ::shm_open (name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+      if (fd < 0)
+        return { };
+
+      void* mapping = MAP_FAILED;
+      if (::ftruncate (fd, data.size()) == 0)
+        mapping = ::mmap (nullptr, data.size(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      ::close (fd);
+      if (mapping == MAP_FAILED) {
+        ::shm_unlink (name.c_str());
+        return { };
+      }
+      std::memcpy (mapping, data.data(), data.size());
+      ::munmap (mapping, data.size());
+      return name;
+    }
+#endif
+
+
+    // options for images encoded using the kitty graphics protocol:
+    struct KittyOptions {
+      // send the pixel data via shared memory (see kitty_shared_memory()):
+      bool shared_memory = false;
+      // if non-zero, the ID of the image (and of its placement) to replace,
+      // so that frames displayed in place do not accumulate in the terminal:
+      std::uint32_t image_id = 0;
+    };
+
+    // the options for images displayed in the current context:
+    inline KittyOptions kitty_options (const Sink& sink)
+    {
+      return { kitty_shared_memory (sink), in_place_state.active ? in_place_state.image_id : 0 };
+    }
+
+
+    // encode the image as a kitty graphics command, sending the RGB pixel
+    // data via shared memory or inline, as specified by `options`. If
+    // `cancel` is provided, encoding stops early (returning an empty string)
+    // once it is set:
+    template <class ImageType>
+      inline std::string encode_kitty (const ImageType& image, const ColourMap& cmap,
+          const std::atomic<bool>* cancel = nullptr, const KittyOptions& options = { })
+      {
+        // colourmap intensities range from 0 to 100, rather than 255:
+        const int cmap_size = cmap.size();
+        std::vector<RGB> colours (cmap_size);
+        for (int n = 0; n < cmap_size; ++n)
+          for (int i = 0; i < 3; ++i)
+            colours[n][i] = (std::min (int (cmap[n][i]), 100) * 255 + 50) / 100;
+
+        const int x_dim = image.width(), y_dim = image.height();
+        std::vector<unsigned char> pixels (3*std::size_t (x_dim)*y_dim, 0);
+        unsigned char* p = pixels.data();
+        for (int y = 0; y < y_dim; ++y) {
+          if (cancel && cancel->load (std::memory_order_relaxed))
+            return { };
+          for (int x = 0; x < x_dim; ++x, p += 3) {
+            const int c = static_cast<int> (image(x,y));
+            if (c >= 0 && c < cmap_size)
+              std::memcpy (p, colours[c].data(), 3);
+          }
+        }
+
+        // q=2 suppresses responses from the terminal:
+        std::string header = std::format ("\033_Ga=T,f=24,s={},v={},q=2", x_dim, y_dim);
+        if (options.image_id)
+          header += std::format (",i={},p=1", options.image_id);
+        std::string out;
+
+#if defined(__unix__) || defined(__APPLE__)
+        if (options.shared_memory) {
+          const std::string name = kitty_shared_memory_object (pixels);
+          if (name.size()) {
+            out = header + std::format (",t=s,S={};", pixels.size());
+            base64_encode (out, reinterpret_cast<const unsigned char*> (name.data()), name.size());
+            out += "\033\\\n";
+            return out;
+          }
+        }
+#endif
+
+        // data sent inline must be split into chunks of at most 4096 bytes:
+        constexpr std::size_t chunk_size = 4096;
+        std::string data;
+        base64_encode (data, pixels.data(), pixels.size());
+        for (std::size_t n = 0; n < data.size(); n += chunk_size) {
+          const int more = n + chunk_size < data.size();
+          out += n ? std::format ("\033_Gm={};", more) : header + std::format (",m={};", more);
+          out.append (data, n, chunk_size);
+          out += "\033\\";
+        }
+        out += '\n';
+        return out;
+      }
+
+
+
+
+    // fast streaming hash, used to identify images in the FrameCache. Values
+    // are distributed over 4 independent lanes, which avoids serialising the
+    // multiplications, and combined using the splitmix64 finaliser:
+    class FrameHash {
+      public:
+        void add (std::uint64_t value) {
+          auto& lane = lanes[n++ & 3U];
+          lane = (lane ^ value) * 0x9E3779B97F4A7C15ULL;
+          lane ^= lane >> 29;
+        }
+        void add (double value) { add (std::bit_cast<std::uint64_t> (value)); }
+        void add (const ColourMap& cmap) {
+          add (std::uint64_t (cmap.size()));
+          for (const auto& c : cmap)
+            add (std::uint64_t (c[0]) | std::uint64_t (c[1])<<8 | std::uint64_t (c[2])<<16);
+        }
+
+        template <class ImageType>
+          void add_image (const ImageType& image) {
+            using value_type = std::remove_cvref_t<decltype(image(0,0))>;
+            add (std::uint64_t (image.width()));
+            add (std::uint64_t (image.height()));
+            for (int y = 0; y < image.height(); ++y) {
+              for (int x = 0; x < image.width(); ++x) {
+                if constexpr (std::is_floating_point_v<value_type>)
+                  add (double (image(x,y)));
+                else if constexpr (std::is_integral_v<value_type>)
+                  add (std::uint64_t (image(x,y)));
+                else if constexpr (std::is_convertible_v<value_type,RGB>) {
+                  const RGB c = image(x,y);
+                  add (std::uint64_t (c[0]) | std::uint64_t (c[1])<<8 | std::uint64_t (c[2])<<16);
+                }
+                else {
+                  // other value types cannot be hashed reliably:
+                  hashable = false;
+                  return;
+                }
+              }
+            }
+          }
+
+        // whether all the values added could be hashed:
+        bool valid () const { return hashable; }
+
+        std::uint64_t value () const {
+          std::uint64_t h = n;
+          for (const auto lane : lanes) {
+            h = (h ^ lane) + 0x9E3779B97F4A7C15ULL;
+            h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+            h ^= h >> 31;
+          }
+          return h;
+        }
+
+      private:
+        std::array<std::uint64_t,4> lanes = {
+          0x243F6A8885A308D3ULL, 0x13198A2E03707344ULL, 0xA4093822299F31D0ULL, 0x082EFA98EC4E6C89ULL };
+        std::uint64_t n = 0;
+        bool hashable = true;
+    };
+
+    // identifies the different ways of producing an image, so that their
+    // hashes never coincide:
+    enum class FrameKind : std::uint64_t { Indexed, Packed, Scalar, RGBPalette, RGBAdaptive };
+
+    // display the image produced by `encode (kitty_options)`, re-using the
+    // output from the FrameCache if active and already present. `key`
+    // returns the FrameHash identifying the image, and is only invoked if a
+    // cache is active; images that cannot be hashed are not cached. Output
+    // referring to shared memory can only be written once, so is never
+    // cached either:
+    template <class KeyFunction, class EncodeFunction>
+      inline void display_cached (KeyFunction&& key, EncodeFunction&& encode, Sink& sink)
+      {
+        const KittyOptions options = kitty_options (sink);
+        if (!active_frame_cache || options.shared_memory) {
+          display (encode (options), sink);
+          return;
+        }
+        FrameHash h = key();
+        if (!h.valid()) {
+          display (encode (options), sink);
+          return;
+        }
+        h.add (std::uint64_t (current_protocol));
+        h.add (std::uint64_t (options.image_id));
+        const std::uint64_t hash = h.value();
+        if (const std::string* cached = active_frame_cache->find (hash)) {
+          display (*cached, sink);
+          return;
+        }
+        std::string out = encode (options);
+        display (out, sink);
+        active_frame_cache->insert (hash, std::move (out));
+      }
+
+
+
+
+    inline void commit (std::string& out, ctype current, int repeats)
+    {
+      if (repeats <=3)
+        out.append (repeats, char(63+current));
+      else
+        out += std::format ("!{}{}", repeats, char(63+current));
+    }
+
+
+    // fetch the intensities for the band of `nsixels` rows starting at row
+    // y0, stored column by column (6 entries per column) in the order the
+    // encoder consumes them. Each pixel is evaluated exactly once, in row
+    // order:
+    template <class ImageType>
+      inline void load_band (const ImageType& im, int y0, int nsixels, std::vector<int>& band)
+      {
+        const int x_dim = im.width();
+        for (int y = 0; y < nsixels; ++y)
+          for (int x = 0; x < x_dim; ++x)
+            band[6*x+y] = static_cast<int> (im(x,y+y0));
+      }
+
+
+    // encode a band of sixels in a single pass over the intensities, by
+    // first building the sixel masks for all colours, then run-length
+    // encoding the rows of masks for those colours actually present in the
+    // band. `masks` must be of size cmap_size*x_dim, and zero on entry; it is
+    // reset to zero on exit.
+    inline void encode_band (std::string& out, const std::vector<int>& band, int x_dim, int nsixels,
+        int cmap_size, std::vector<ctype>& masks, std::vector<char>& used)
+    {
+      for (int x = 0; x < x_dim; ++x) {
+        for (int y = 0; y < nsixels; ++y) {
+          const int c = band[6*x+y];
+          if (c >= 0 && c < cmap_size) {
+            masks[c*x_dim+x] |= 1U<<y;
+            used[c] = true;
+          }
+        }
+      }
+
+      bool first = true;
+      for (int intensity = 0; intensity < cmap_size; ++intensity) {
+        if (!used[intensity])
+          continue;
+        used[intensity] = false;
+
+        if (first) first = false;
+        else out += '$';
+        out += std::format ("#{}", intensity);
+
+        ctype* row = masks.data() + intensity*x_dim;
+        ctype current = row[0];
+        int repeats = 1;
+        for (int x = 1; x < x_dim; ++x) {
+          if (row[x] == current) {
+            ++repeats;
+            continue;
+          }
+          commit (out, current, repeats);
+          current = row[x];
+          repeats = 1;
+        }
+        commit (out, current, repeats);
+        std::fill (row, row+x_dim, 0);
+      }
+      out += '-';
+    }
+
+
+
+    // run-length encode the band of sixel masks held column by column in
+    // `columns`, for those of the first N colours that are `used` in the
+    // band:
+    template <int N>
+      inline void encode_columns (std::string& out, const std::vector<std::array<ctype,N>>& columns,
+          int x_dim, int cmap_size, const std::array<ctype,N>& used)
+      {
+        bool first = true;
+        for (int n = 0; n < std::min (N, cmap_size); ++n) {
+          if (!used[n])
+            continue;
+
+          if (first) first = false;
+          else out += '$';
+          out += std::format ("#{}", n);
+
+          ctype current = columns[0][n];
+          int repeats = 1;
+          for (int x = 1; x < x_dim; ++x) {
+            if (columns[x][n] == current) {
+              ++repeats;
+              continue;
+            }
+            commit (out, current, repeats);
+            current = columns[x][n];
+            repeats = 1;
+          }
+          commit (out, current, repeats);
+        }
+        out += '-';
+      }
+
+
+
+    // equivalent to encode_band() for small colourmaps of up to N entries,
+    // known at compile-time. The sixel masks for all colours at each column
+    // are small enough to be built in registers, and are stored together,
+    // so that the loops over colours can be fully unrolled, and no clearing
+    // of the masks is required between bands. `columns` must be of size
+    // x_dim.
+    template <int N>
+      inline void encode_band (std::string& out, const std::vector<int>& band, int x_dim, int nsixels,
+          int cmap_size, std::vector<std::array<ctype,N>>& columns)
+      {
+        std::array<ctype,N> used = { };
+        for (int x = 0; x < x_dim; ++x) {
+          std::array<ctype,N> masks = { };
+          for (int y = 0; y < nsixels; ++y) {
+            const int c = band[6*x+y];
+            if (c >= 0 && c < N)
+              masks[c] |= 1U<<y;
+          }
+          for (int n = 0; n < N; ++n)
+            used[n] |= masks[n];
+          columns[x] = masks;
+        }
+
+        encode_columns<N> (out, columns, x_dim, cmap_size, used);
+      }
+
+
+
+    // helpers to compute the sixel masks of a PackedImage directly from the
+    // packed words. Given a word of packed pixels, return a word with bit n
+    // set if pixel n matches the value c (i.e. the pixels' match bits are
+    // packed contiguously in the lowest bits):
+    template <int Bits>
+      inline std::uint64_t packed_match (std::uint64_t word, std::uint64_t c)
+      {
+        if constexpr (Bits == 1)
+          return c ? word : ~word;
+        else if constexpr (Bits == 2) {
+          word ^= c * 0x5555555555555555ULL;
+          word = ~(word | word>>1) & 0x5555555555555555ULL;
+          word = (word | word>>1) & 0x3333333333333333ULL;
+          word = (word | word>>2) & 0x0F0F0F0F0F0F0F0FULL;
+          word = (word | word>>4) & 0x00FF00FF00FF00FFULL;
+          word = (word | word>>8) & 0x0000FFFF0000FFFFULL;
+          return (word | word>>16) & 0x00000000FFFFFFFFULL;
+        }
+        else {
+          word ^= c * 0x1111111111111111ULL;
+          word |= word>>1;
+          word = ~(word | word>>2) & 0x1111111111111111ULL;
+          word = (word | word>>3) & 0x0303030303030303ULL;
+          word = (word | word>>6) & 0x000F000F000F000FULL;
+          word = (word | word>>12) & 0x000000FF000000FFULL;
+          return (word | word>>24) & 0x000000000000FFFFULL;
+        }
+      }
+
+    // spread the 8 bits of a byte into the lowest bit of each byte of the
+    // result:
+    inline std::uint64_t spread_bits (std::uint64_t byte)
+    {
+      return (((byte & 0x7FU) * 0x0002040810204081ULL) & 0x0101010101010101ULL) | ((byte & 0x80U) << 49);
+    }
+
+
+    // equivalent to encode_band<N>() for a band of a PackedImage. The match
+    // bits for 8 pixels across all rows of the band are combined into 8
+    // sixel masks at once, one per byte of a 64-bit word.
+    template <int Bits>
+      inline void encode_packed_band (std::string& out, const PackedImage<Bits>& image, int y0, int nsixels,
+          int cmap_size, std::vector<std::array<ctype,(1<<Bits)>>& columns)
+      {
+        constexpr int N = 1<<Bits;
+        constexpr int ppw = PackedImage<Bits>::pixels_per_word;
+        const int x_dim = image.width();
+        const int nwords = (x_dim + ppw - 1) / ppw;
+
+        std::array<const std::uint64_t*,6> rows;
+        for (int y = 0; y < nsixels; ++y)
+          rows[y] = image.row (y0+y);
+
+        std::array<ctype,N> used = { };
+        for (int w = 0; w < nwords; ++w) {
+          const int x0 = w*ppw;
+          const int npixels = std::min (ppw, x_dim-x0);
+          const std::uint64_t valid = npixels < 64 ? (1ULL << npixels) - 1 : ~0ULL;
+          std::fill (columns.begin()+x0, columns.begin()+x0+npixels, std::array<ctype,N> { });
+          for (int c = 0; c < std::min (N, cmap_size); ++c) {
+            std::array<std::uint64_t,6> match;
+            std::uint64_t any = 0;
+            for (int y = 0; y < nsixels; ++y)
+              any |= match[y] = packed_match<Bits> (rows[y][w], c) & valid;
+            if (!any)
+              continue;
+            used[c] = true;
+
+            for (int x = 0; x < npixels; x += 8) {
+              std::uint64_t masks = 0;
+              for (int y = 0; y < nsixels; ++y)
+                masks |= spread_bits ((match[y] >> x) & 0xFFU) << y;
+              for (int n = 0; n < std::min (8, npixels-x); ++n)
+                columns[x0+x+n][c] = masks >> (8*n);
+            }
+          }
+        }
+
+        encode_columns<N> (out, columns, x_dim, cmap_size, used);
+      }
+
+
+
+    // encode the whole image, one band at a time. If N is non-zero, use
+    // the encoder specialised for colourmaps of up to N entries. If
+    // `cancel` is provided, encoding stops early (leaving the output
+    // incomplete) once it is set:
+    template <int N, class ImageType>
+      inline void encode (std::string& out, const ImageType& image, int cmap_size,
+          const std::atomic<bool>* cancel = nullptr)
+      {
+        const int x_dim = image.width();
+        std::vector<int> band (6*x_dim);
+
+        if constexpr (N > 0) {
+          std::vector<std::array<ctype,N>> columns (x_dim);
+          for (int y = 0; y < image.height(); y += 6) {
+            if (cancel && cancel->load (std::memory_order_relaxed))
+              return;
+            const int nsixels = std::min (image.height()-y, 6);
+            load_band (image, y, nsixels, band);
+            encode_band<N> (out, band, x_dim, nsixels, cmap_size, columns);
+          }
+        }
+        else {
+          std::vector<ctype> masks (cmap_size*x_dim, 0);
+          std::vector<char> used (cmap_size, false);
+          for (int y = 0; y < image.height(); y += 6) {
+            if (cancel && cancel->load (std::memory_order_relaxed))
+              return;
+            const int nsixels = std::min (image.height()-y, 6);
+            load_band (image, y, nsixels, band);
+            encode_band (out, band, x_dim, nsixels, cmap_size, masks, used);
+          }
+        }
+      }
+
+  }
+
+
+
+
+
+
+
+  inline InPlace::InPlace (bool no_scrolling, Sink& sink) :
+    sink (sink),
+    nested (in_place_state.active)
+  {
+    // a nested object must not save the cursor position again, since that
+    // would overwrite the position saved by the enclosing scope:
+    if (!nested)
+      in_place_state = { true, no_scrolling, true, new_kitty_image_id() };
+  }
+
+  inline InPlace::~InPlace ()
+  {
+    if (nested)
+      return;
+    if (in_place_state.no_scrolling && !in_place_state.first_frame) {
+      // destructors must not throw - failing to restore the mode is not fatal:
+      try { sink.write_control ("\033[?80l"); }
+      catch (...) { }
+    }
+    in_place_state = { };
+  }
+
+
+
+  inline FrameCache::FrameCache (std::size_t max_bytes) :
+    max_bytes (max_bytes),
+    bytes (0),
+    nhits (0),
+    nmisses (0),
+    previous (active_frame_cache)
+  {
+    active_frame_cache = this;
+  }
+
+  inline FrameCache::~FrameCache ()
+  {
+    active_frame_cache = previous;
+  }
+
+
+  inline const std::string* FrameCache::find (std::uint64_t key)
+  {
+    const auto entry = index.find (key);
+    if (entry == index.end()) {
+      ++nmisses;
+      return nullptr;
+    }
+    ++nhits;
+    // move most recently used entry to the front:
+    entries.splice (entries.begin(), entries, entry->second);
+    return &entry->second->second;
+  }
+
+
+  inline void FrameCache::insert (std::uint64_t key, std::string encoded)
+  {
+    if (encoded.size() > max_bytes || index.contains (key))
+      return;
+    while (bytes + encoded.size() > max_bytes) {
+      bytes -= entries.back().second.size();
+      index.erase (entries.back().first);
+      entries.pop_back();
+    }
+    bytes += encoded.size();
+    entries.emplace_front (key, std::move (encoded));
+    index[key] = entries.begin();
+  }
+
+
+  inline void FrameCache::clear ()
+  {
+    entries.clear();
+    index.clear();
+    bytes = 0;
+  }
+
+
+
+  namespace {
+
+    template <class ImageType>
+      inline std::string encode_indexed (const ImageType& image, const ColourMap& cmap,
+          const std::atomic<bool>* cancel = nullptr, const KittyOptions& kitty = { })
+      {
+        if (current_protocol != Protocol::Sixel)
+          return encode_kitty (image, cmap, cancel, kitty);
+
+        std::string out = "\033P9q" + colourmap_specifier (cmap);
+
+        // use encoder specialised for small colourmaps where possible:
+        const int cmap_size = cmap.size();
+        if (cmap_size <= 2) encode<2> (out, image, cmap_size, cancel);
+        else if (cmap_size <= 4) encode<4> (out, image, cmap_size, cancel);
+        else if (cmap_size <= 8) encode<8> (out, image, cmap_size, cancel);
+        else if (cmap_size <= 16) encode<16> (out, image, cmap_size, cancel);
+        else encode<0> (out, image, cmap_size, cancel);
+
+        out += "\033\\\n";
+        return out;
+      }
+
+  }
+
+
+
+  template <class ImageType>
+    inline void imshow (const ImageType& image, const ColourMap& cmap, Sink& sink)
+    {
+      display_cached (
+          [&] { FrameHash h; h.add (std::uint64_t (FrameKind::Indexed)); h.add (cmap); h.add_image (image); return h; },
+          [&] (const KittyOptions& kitty) { return encode_indexed (image, cmap, nullptr, kitty); },
+          sink);
+    }
+
+
+
+  template <int Bits>
+    inline void imshow (const PackedImage<Bits>& image, const ColourMap& cmap, Sink& sink)
+    {
+      auto key = [&] {
+        FrameHash h;
+        h.add (std::uint64_t (FrameKind::Packed) | std::uint64_t (Bits)<<8);
+        h.add (cmap);
+        h.add (std::uint64_t (image.width()));
+        h.add (std::uint64_t (image.height()));
+        const int nwords = (image.width() + PackedImage<Bits>::pixels_per_word - 1) / PackedImage<Bits>::pixels_per_word;
+        for (int y = 0; y < image.height(); ++y)
+          for (int w = 0; w < nwords; ++w)
+            h.add (image.row(y)[w]);
+        return h;
+      };
+
+      auto encode = [&] (const KittyOptions& kitty) {
+        if (current_protocol != Protocol::Sixel)
+          return encode_kitty (image, cmap, nullptr, kitty);
+
+        std::string out = "\033P9q" + colourmap_specifier (cmap);
+        std::vector<std::array<ctype,(1<<Bits)>> columns (image.width());
+        for (int y = 0; y < image.height(); y += 6) {
+          const int nsixels = std::min (image.height()-y, 6);
+          encode_packed_band (out, image, y, nsixels, cmap.size(), columns);
+        }
+        out += "\033\\\n";
+        return out;
+      };
+
+      display_cached (key, encode, sink);
+    }
+
+
+
+  template <class ImageType>
+    inline void imshow (const ImageType& image, double min, double max, const ColourMap& cmap, Sink& sink)
+    {
+      display_cached (
+          [&] { FrameHash h; h.add (std::uint64_t (FrameKind::Scalar)); h.add (min); h.add (max); h.add (cmap); h.add_image (image); return h; },
+          [&] (const KittyOptions& kitty) { return encode_indexed (Rescale<ImageType> (image, min, max, cmap.size()), cmap, nullptr, kitty); },
+          sink);
+    }
+
+
+
+
+  // **************************************************************************
+  //                   parallel processing helpers
+  // **************************************************************************
+
+  namespace {
+
+    // number of threads to use to process `size` items, ensuring each thread
+    // processes at least `min_chunk` items:
+    inline int num_threads (std::size_t size, std::size_t min_chunk)
+    {
+      const std::size_t max_threads = std::max (1U, std::thread::hardware_concurrency());
+      return std::clamp (size / std::max (min_chunk, std::size_t (1)), std::size_t (1), max_threads);
+    }
+
+    // invoke func (n, start, end) on `nthreads` contiguous chunks of the
+    // range [begin, end) concurrently, where n is the index of the chunk:
+    template <class Functor>
+      inline void parallel_for (int nthreads, std::size_t begin, std::size_t end, Functor&& func)
+      {
+        auto chunk_start = [&] (int n) { return begin + (end-begin)*n/nthreads; };
+        std::vector<std::thread> threads;
+        for (int n = 1; n < nthreads; ++n)
+          threads.emplace_back (std::ref (func), n, chunk_start (n), chunk_start (n+1));
+        func (0, chunk_start (0), chunk_start (1));
+        for (auto& t : threads)
+          t.join();
+      }
+
+  }
+
+
+
+
+  // **************************************************************************
+  //                   auto_window implementation
+  // **************************************************************************
+
+  namespace {
+
+    // find range of finite intensities, considering only every
+    // `subsample`-th pixel along each axis:
+    template <class ImageType>
+      inline std::array<double,2> intensity_range (const ImageType& image, int subsample)
+      {
+        using value_type = std::remove_cvref_t<decltype(image(0,0))>;
+
+        const int x_dim = image.width();
+        const int y_rows = (image.height() + subsample - 1) / subsample;
+        const int nthreads = num_threads (std::size_t (y_rows) * (x_dim / subsample), 1U<<16);
+
+        std::vector<std::array<double,2>> ranges (nthreads,
+            { std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity() });
+        parallel_for (nthreads, 0, y_rows, [&] (int n, std::size_t start, std::size_t end) {
+            value_type min = std::numeric_limits<value_type>::max();
+            value_type max = std::numeric_limits<value_type>::lowest();
+            bool found = false;
+            for (std::size_t y = start*subsample; y < end*subsample; y += subsample) {
+              for (int x = 0; x < x_dim; x += subsample) {
+                const value_type val = image(x,y);
+                if constexpr (std::is_floating_point_v<value_type>)
+                  if (!std::isfinite (val))
+                    continue;
+                min = std::min (min, val);
+                max = std::max (max, val);
+                found = true;
+              }
+            }
+            if (found)
+              ranges[n] = { static_cast<double> (min), static_cast<double> (max) };
+            });
+
+        double min = std::numeric_limits<double>::infinity(), max = -min;
+        for (const auto& r : ranges) {
+          min = std::min (min, r[0]);
+          max = std::max (max, r[1]);
+        }
+        return { min, max };
+      }
+
+
+
+    // histogram of finite intensities, considering only every
+    // `subsample`-th pixel along each axis. Each intensity is assigned to
+    // bin (val-min)*scale, clamped to the available bins:
+    template <class ImageType>
+      inline std::vector<std::size_t> intensity_histogram (const ImageType& image,
+          double min, double scale, int nbins, int subsample)
+      {
+        using value_type = std::remove_cvref_t<decltype(image(0,0))>;
+
+        const int x_dim = image.width();
+        const int y_rows = (image.height() + subsample - 1) / subsample;
+        const int nthreads = num_threads (std::size_t (y_rows) * (x_dim / subsample), 1U<<16);
+
+        std::vector<std::vector<std::size_t>> histograms (nthreads);
+        parallel_for (nthreads, 0, y_rows, [&] (int n, std::size_t start, std::size_t end) {
+            auto& hist = histograms[n];
+            hist.assign (nbins, 0);
+            for (std::size_t y = start*subsample; y < end*subsample; y += subsample) {
+              for (int x = 0; x < x_dim; x += subsample) {
+                const double val = image(x,y);
+                if constexpr (std::is_floating_point_v<value_type>)
+                  if (!std::isfinite (val))
+                    continue;
+                const double bin = scale * (val - min);
+                ++hist[bin > 0.0 ? std::min (static_cast<int> (bin), nbins-1) : 0];
+              }
+            }
+            });
+
+        auto& hist = histograms[0];
+        for (int n = 1; n < nthreads; ++n)
+          for (int i = 0; i < nbins; ++i)
+            hist[i] += histograms[n][i];
+        return std::move (hist);
+      }
+
+  }
+
+
+
+  template <class ImageType>
+    inline std::array<double,2> auto_window (const ImageType& image, double lower, double upper, int subsample)
+    {
+      using value_type = std::remove_cvref_t<decltype(image(0,0))>;
+
+      if (lower < 0.0 || upper > 100.0 || lower > upper)
+        throw std::runtime_error (std::format ("invalid percentiles [ {} {} ] for automatic window", lower, upper));
+      subsample = std::max (subsample, 1);
+
+      const auto [ min, max ] = intensity_range (image, subsample);
+      if (!std::isfinite (min))
+        throw std::runtime_error ("no finite intensities found in image for automatic window");
+
+      // widen a degenerate window, so that it can be used to rescale the
+      // image without dividing by zero:
+      auto window = [] (double from, double to) -> std::array<double,2> {
+        if (from < to)
+          return { from, to };
+        const double mid = 0.5 * (from + to);
+        return { mid - 0.5, mid + 0.5 };
+      };
+
+      if ((lower == 0.0 && upper == 100.0) || min == max)
+        return window (min, max);
+
+      // for integer types with small enough range, use one bin per value:
+      const bool exact = std::is_integral_v<value_type> && max-min < 4096;
+      const int nbins = exact ? max-min+1 : 4096;
+      const double scale = exact ? 1.0 : nbins / (max-min);
+
+      const auto hist = intensity_histogram (image, min, scale, nbins, subsample);
+      std::size_t total = 0;
+      for (const auto& count : hist)
+        total += count;
+
+      // find intensity at which the cumulative count crosses the target
+      // fraction, interpolating linearly within the bin if not exact:
+      auto percentile = [&] (double fraction) {
+        const double target = fraction * total / 100.0;
+        std::size_t cumulative = 0;
+        for (int i = 0; i < nbins; ++i) {
+          if (cumulative + hist[i] >= target && hist[i]) {
+            if (exact)
+              return min + i;
+            return min + (i + (target - cumulative) / hist[i]) / scale;
+          }
+          cumulative += hist[i];
+        }
+        return max;
+      };
+
+      return window (std::max (min, percentile (lower)), std::min (max, percentile (upper)));
+    }
+
+
+
+
+  // **************************************************************************
+  //                   Remap implementation
+  // **************************************************************************
+
+  namespace {
+    constexpr int remap_table_size = 4096;
+  }
+
+
+  template <class ImageType>
+    template <class Functor>
+    inline Remap<ImageType>::Remap (const ImageType& image, double minval, double maxval, int cmap_size,
+        bool logarithmic, Functor&& func) :
+      im (image),
+      min (minval),
+      scale (remap_table_size / (maxval - minval)),
+      logarithmic (logarithmic),
+      key_min (0),
+      shift (0)
+    {
+      if (!(maxval > minval))
+        throw std::runtime_error (std::format ("invalid intensity range [ {} {} ]", minval, maxval));
+
+      auto index = [&] (double t) {
+        return ctype (std::round (std::clamp (cmap_size * func (std::clamp (t, 0.0, 1.0)), 0.0, cmap_size-1.0)));
+      };
+
+      if (!logarithmic) {
+        table.resize (remap_table_size);
+        for (int n = 0; n < remap_table_size; ++n)
+          table[n] = index ((n+0.5) / remap_table_size);
+        return;
+      }
+
+      // The bit pattern of a positive float, interpreted as an integer,
+      // increases monotonically with its value, and approximates its
+      // logarithm: the exponent in the upper bits, followed by the
+      // mantissa as a linear interpolant between powers of 2. Shifting it
+      // right gives a table index equally spaced on a piecewise linear
+      // approximation to a logarithmic scale:
+      if (minval <= 0.0)
+        throw std::runtime_error ("minimum intensity must be positive for logarithmic display");
+      key_min = key (minval);
+      const std::uint32_t range = key (maxval) - key_min;
+      while ((range >> shift) >= remap_table_size)
+        ++shift;
+
+      const double log_min = std::log (minval), log_range = std::log (maxval) - log_min;
+      table.resize ((range >> shift) + 1);
+      for (std::size_t n = 0; n < table.size(); ++n) {
+        const double centre = std::bit_cast<float> (key_min + std::uint32_t ((2*n+1) << shift) / 2);
+        table[n] = index ((std::log (centre) - log_min) / log_range);
+      }
+    }
+
+  template <class ImageType>
+    inline int Remap<ImageType>::width () const { return im.width(); }
+
+  template <class ImageType>
+    inline int Remap<ImageType>::height () const { return im.height(); }
+
+  template <class ImageType>
+    inline ctype Remap<ImageType>::operator() (int x, int y) const {
+      const auto val = im(x,y);
+      if (logarithmic) {
+        if (!(val > min))
+          return table.front();
+        const std::uint32_t offset = (key (val) - key_min) >> shift;
+        return table[std::min (offset, std::uint32_t (table.size()-1))];
+      }
+      const double offset = scale * (val - min);
+      return table[offset > 0.0 ? std::min (static_cast<int> (offset), remap_table_size-1) : 0];
+    }
+
+
+
+  template <class ImageType>
+    inline Remap<ImageType> gamma (const ImageType& image, double min, double max, double gamma, int cmap_size)
+    {
+      return { image, min, max, cmap_size, false, [gamma] (double t) { return std::pow (t, gamma); } };
+    }
+
+  template <class ImageType>
+    inline Remap<ImageType> logscale (const ImageType& image, double min, double max, int cmap_size)
+    {
+      return { image, min, max, cmap_size, true, [] (double t) { return t; } };
+    }
+
+  template <class ImageType>
+    inline Remap<ImageType> equalise (const ImageType& image, double min, double max, int cmap_size)
+    {
+      // cumulative histogram, normalised to [ 0 1 ], evaluated at the centre
+      // of each bin:
+      const auto hist = intensity_histogram (image, min, remap_table_size / (max - min), remap_table_size, 1);
+      std::vector<double> cdf (remap_table_size);
+      double total = 0.0;
+      for (int n = 0; n < remap_table_size; ++n) {
+        cdf[n] = total + 0.5*hist[n];
+        total += hist[n];
+      }
+      for (auto& c : cdf)
+        c /= std::max (total, 1.0);
+
+      return { image, min, max, cmap_size, false, [&cdf] (double t) {
+        return cdf[std::min (static_cast<int> (t * remap_table_size), remap_table_size-1)];
+      } };
+    }
+
+
+
+
+  // **************************************************************************
+  //                   RGB support implementation
+  // **************************************************************************
+
+  inline Palette::Palette (const ColourMap& colourmap) :
+    cmap (colourmap),
+    lut (32*32*32)
+  {
+    if (cmap.empty() || cmap.size() > 256)
+      throw std::runtime_error (std::format ("invalid number of colours ({}) for palette", cmap.size()));
+
+    // find the nearest colour to the centre of each cell in the lookup
+    // table. Each thread handles a different range of red levels:
+    const int nthreads = num_threads (32*32*32*cmap.size(), 1U<<20);
+    parallel_for (nthreads, 0, 32, [&] (int, std::size_t start, std::size_t end) {
+        for (int r = start; r < static_cast<int> (end); ++r) {
+          for (int g = 0; g < 32; ++g) {
+            for (int b = 0; b < 32; ++b) {
+              const std::array<float,3> centre = { 8*r+3.5f, 8*g+3.5f, 8*b+3.5f };
+              float min_dist = std::numeric_limits<float>::infinity();
+              for (std::size_t n = 0; n < cmap.size(); ++n) {
+                float dist = 0.0f;
+                for (int i = 0; i < 3; ++i) {
+                  const float delta = 2.55f*cmap[n][i] - centre[i];
+                  dist += delta*delta;
+                }
+                if (dist < min_dist) {
+                  min_dist = dist;
+                  lut[(r<<10) | (g<<5) | b] = n;
+                }
+              }
+            }
+          }
+        }
+        });
+  }
+
+
+
+  inline Palette Palette::uniform (int red, int green, int blue)
+  {
+    if (red < 2 || green < 2 || blue < 2 || red*green*blue > 256)
+      throw std::runtime_error (std::format ("invalid number of levels ({} x {} x {}) for uniform palette", red, green, blue));
+
+    ColourMap colourmap;
+    for (int r = 0; r < red; ++r)
+      for (int g = 0; g < green; ++g)
+        for (int b = 0; b < blue; ++b)
+          colourmap.push_back ({
+              ctype (std::round (100.0*r/(red-1))),
+              ctype (std::round (100.0*g/(green-1))),
+              ctype (std::round (100.0*b/(blue-1))) });
+    return Palette (colourmap);
+  }
+
+
+
+  template <class ImageType>
+    inline Palette Palette::adaptive (const ImageType& image, int max_colours)
+    {
+      max_colours = std::clamp (max_colours, 1, 256);
+
+      // histogram of 5-bit colours, along with the sum of the original
+      // intensities in each cell, over a regular subsample of the image:
+      constexpr int nbins = 32*32*32;
+      std::vector<std::uint32_t> count (nbins, 0);
+      std::vector<std::array<std::uint64_t,3>> sum (nbins, { 0, 0, 0 });
+      const int step = std::max (1, static_cast<int> (std::sqrt (double (image.width()) * image.height() / 65536.0)));
+      for (int y = 0; y < image.height(); y += step) {
+        for (int x = 0; x < image.width(); x += step) {
+          const RGB c = image(x,y);
+          const int n = ((c[0]>>3)<<10) | ((c[1]>>3)<<5) | (c[2]>>3);
+          ++count[n];
+          for (int i = 0; i < 3; ++i)
+            sum[n][i] += c[i];
+        }
+      }
+
+      // median cut: boxes partition the whole colour cube, and are split
+      // in turn (largest population first) at the median of their occupied
+      // range along their longest occupied axis:
+      struct Box {
+        std::array<int,3> lo, hi, occupied_lo, occupied_hi;
+        std::size_t count;
+      };
+      auto for_each_cell = [] (const Box& box, auto&& func) {
+        for (int r = box.lo[0]; r <= box.hi[0]; ++r)
+          for (int g = box.lo[1]; g <= box.hi[1]; ++g)
+            for (int b = box.lo[2]; b <= box.hi[2]; ++b)
+              func (r, g, b, (r<<10) | (g<<5) | b);
+      };
+      auto update = [&] (Box& box) {
+        box.count = 0;
+        box.occupied_lo = box.hi;
+        box.occupied_hi = box.lo;
+        for_each_cell (box, [&] (int r, int g, int b, int n) {
+            if (!count[n]) return;
+            box.count += count[n];
+            const std::array<int,3> c = { r, g, b };
+            for (int i = 0; i < 3; ++i) {
+              box.occupied_lo[i] = std::min (box.occupied_lo[i], c[i]);
+              box.occupied_hi[i] = std::max (box.occupied_hi[i], c[i]);
+            }
+            });
+      };
+
+      std::vector<Box> boxes (1, Box { { 0, 0, 0 }, { 31, 31, 31 }, { }, { }, 0 });
+      update (boxes[0]);
+
+      while (static_cast<int> (boxes.size()) < max_colours) {
+        auto extent = [] (const Box& box, int axis) { return box.occupied_hi[axis] - box.occupied_lo[axis]; };
+        auto longest = [&] (const Box& box) {
+          int axis = 0;
+          for (int i = 1; i < 3; ++i)
+            if (extent (box, i) > extent (box, axis))
+              axis = i;
+          return axis;
+        };
+
+        Box* target = nullptr;
+        for (auto& box : boxes)
+          if (extent (box, longest (box)) > 0 && (!target || box.count > target->count))
+            target = &box;
+        if (!target)
+          break;
+
+        // find plane along longest axis below which half the samples lie:
+        const int axis = longest (*target);
+        std::vector<std::size_t> plane_count (32, 0);
+        for_each_cell (*target, [&] (int r, int g, int b, int n) {
+            plane_count[std::array<int,3> { r, g, b }[axis]] += count[n]; });
+        std::size_t cumulative = 0;
+        int split = target->occupied_lo[axis];
+        for (; split < target->occupied_hi[axis]-1; ++split) {
+          cumulative += plane_count[split];
+          if (2*cumulative >= target->count)
+            break;
+        }
+
+        Box upper = *target;
+        target->hi[axis] = split;
+        upper.lo[axis] = split+1;
+        update (*target);
+        update (upper);
+        boxes.push_back (upper);
+      }
+
+      // palette entries are the mean colour of the samples in each box:
+      Palette palette;
+      palette.lut.resize (nbins);
+      for (std::size_t index = 0; index < boxes.size(); ++index) {
+        std::array<std::uint64_t,3> total = { 0, 0, 0 };
+        for_each_cell (boxes[index], [&] (int, int, int, int n) {
+            palette.lut[n] = index;
+            for (int i = 0; i < 3; ++i)
+              total[i] += sum[n][i];
+            });
+        const double norm = 100.0 / (255.0 * std::max (boxes[index].count, std::size_t (1)));
+        palette.cmap.push_back ({
+            ctype (std::round (total[0]*norm)),
+            ctype (std::round (total[1]*norm)),
+            ctype (std::round (total[2]*norm)) });
+      }
+
+      return palette;
+    }
+
+
+
+  namespace {
+
+    // map the colours of the RGB image onto the palette, and encode:
+    template <class ImageType>
+      inline std::string encode_rgb (const ImageType& image, const Palette& palette, const KittyOptions& kitty = { })
+      {
+        Image<ctype> indices (image.width(), image.height());
+        const int nthreads = num_threads (std::size_t (image.width()) * image.height(), 1U<<16);
+        parallel_for (nthreads, 0, image.height(), [&] (int, std::size_t start, std::size_t end) {
+            for (int y = start; y < static_cast<int> (end); ++y)
+              for (int x = 0; x < image.width(); ++x)
+                indices(x,y) = palette (image(x,y));
+            });
+        return encode_indexed (indices, palette.colourmap(), nullptr, kitty);
+      }
+
+  }
+
+
+
+  template <class ImageType>
+    requires std::convertible_to<decltype(std::declval<const ImageType>()(0,0)), RGB>
+    inline void imshow (const ImageType& image, const Palette& palette, Sink& sink)
+    {
+      display_cached (
+          [&] { FrameHash h; h.add (std::uint64_t (FrameKind::RGBPalette)); h.add (palette.colourmap()); h.add_image (image); return h; },
+          [&] (const KittyOptions& kitty) { return encode_rgb (image, palette, kitty); },
+          sink);
+    }
+
+
+
+  template <class ImageType>
+    requires std::convertible_to<decltype(std::declval<const ImageType>()(0,0)), RGB>
+    inline void imshow (const ImageType& image, int max_colours, Sink& sink)
+    {
+      // identify the image by its contents and the number of colours, so
+      // that a cache hit also skips computing the palette:
+      display_cached (
+          [&] { FrameHash h; h.add (std::uint64_t (FrameKind::RGBAdaptive)); h.add (std::uint64_t (max_colours)); h.add_image (image); return h; },
+          [&] (const KittyOptions& kitty) { return encode_rgb (image, Palette::adaptive (image, max_colours), kitty); },
+          sink);
+    }
+
+
+
+
+  // **************************************************************************
+  //                   Progressive implementation
+  // **************************************************************************
+
+  inline Progressive::Progressive (int factor, int preview_colours, bool no_scrolling, Sink& sink) :
+    sink (sink),
+    factor (std::max (factor, 1)),
+    preview_colours (preview_colours),
+    no_scrolling (no_scrolling),
+    protocol (get_protocol()),
+    image_id (new_kitty_image_id()),
+    generation (0),
+    refined (0),
+    cancel (false),
+    first_frame (true),
+    stopping (false),
+    ncancelled (0),
+    worker ([this] { run(); }) { }
+
+
+  inline Progressive::~Progressive ()
+  {
+    {
+      std::unique_lock lock (mutex);
+      cond.wait (lock, [&] { return refined == generation; });
+      stopping = true;
+    }
+    cond.notify_all();
+    worker.join();
+    if (no_scrolling && !first_frame) {
+      try { sink.write_control ("\033[?80l"); }
+      catch (...) { }
+    }
+  }
+
+
+  template <class ImageType>
+    inline void Progressive::show (const ImageType& image, const ColourMap& cmap)
+    {
+      check();
+
+      // sample the centre of each block of factor x factor pixels:
+      const int w = image.width(), h = image.height();
+      Image<ctype> reduced ((w+factor-1)/factor, (h+factor-1)/factor);
+      for (int y = 0; y < reduced.height(); ++y)
+        for (int x = 0; x < reduced.width(); ++x)
+          reduced(x,y) = image (std::min (x*factor+factor/2, w-1), std::min (y*factor+factor/2, h-1));
+      preview (reduced, w, h, cmap);
+
+      try {
+        Image<ctype> indices (w, h);
+        const int nthreads = num_threads (std::size_t (w) * h, 1U<<16);
+        parallel_for (nthreads, 0, h, [&] (int, std::size_t start, std::size_t end) {
+            for (int y = start; y < static_cast<int> (end); ++y)
+              for (int x = 0; x < w; ++x)
+                indices(x,y) = image(x,y);
+            });
+        refine (std::move (indices), cmap);
+      }
+      catch (...) { abandon(); throw; }
+    }
+
+
+
+  template <class ImageType>
+    inline void Progressive::show (const ImageType& image, double min, double max, const ColourMap& cmap)
+    {
+      check();
+
+      // the preview uses (up to) preview_colours entries, evenly spaced
+      // along the colourmap:
+      const int ncolours = cmap.size();
+      const int npreview = preview_colours > 1 ? std::min (preview_colours, ncolours) : ncolours;
+      ColourMap preview_cmap (npreview);
+      for (int n = 0; n < npreview; ++n)
+        preview_cmap[n] = cmap[npreview > 1 ? std::lround (double (n) * (ncolours-1) / (npreview-1)) : 0];
+
+      const int w = image.width(), h = image.height();
+      const Rescale<ImageType> reduced_indices (image, min, max, npreview);
+      Image<ctype> reduced ((w+factor-1)/factor, (h+factor-1)/factor);
+      for (int y = 0; y < reduced.height(); ++y)
+        for (int x = 0; x < reduced.width(); ++x)
+          reduced(x,y) = reduced_indices (std::min (x*factor+factor/2, w-1), std::min (y*factor+factor/2, h-1));
+      preview (reduced, w, h, preview_cmap);
+
+      try {
+        const Rescale<ImageType> rescaled (image, min, max, ncolours);
+        Image<ctype> indices (w, h);
+        const int nthreads = num_threads (std::size_t (w) * h, 1U<<16);
+        parallel_for (nthreads, 0, h, [&] (int, std::size_t start, std::size_t end) {
+            for (int y = start; y < static_cast<int> (end); ++y)
+              for (int x = 0; x < w; ++x)
+                indices(x,y) = rescaled(x,y);
+            });
+        refine (std::move (indices), cmap);
+      }
+      catch (...) { abandon(); throw; }
+    }
+
+
+
+  inline void Progressive::wait ()
+  {
+    std::unique_lock lock (mutex);
+    cond.wait (lock, [&] { return refined == generation; });
+    lock.unlock();
+    check();
+  }
+
+
+  inline std::size_t Progressive::cancelled () const
+  {
+    std::lock_guard lock (mutex);
+    return ncancelled;
+  }
+
+
+  // report any error raised while writing from the background thread:
+  inline void Progressive::check ()
+  {
+    std::lock_guard lock (mutex);
+    if (error)
+      std::rethrow_exception (std::exchange (error, nullptr));
+  }
+
+
+  // write the encoded image, preceded by the escape sequences to display it
+  // in place. Must be called with the mutex held:
+  inline void Progressive::write (const std::string& image)
+  {
+    const std::array<std::string_view,2> buffers = {
+      first_frame ? (no_scrolling ? "\033[?80h\0337" : "\0337") : "\0338",
+      image
+    };
+    first_frame = false;
+    sink.write (buffers);
+  }
+
+
+  // display the reduced image scaled up to the full size (width x height),
+  // abandoning any refinement still pending for the previous image:
+  inline void Progressive::preview (const Image<ctype>& reduced, int width, int height, const ColourMap& cmap)
+  {
+    struct Upsampled {
+      const Image<ctype>& im;
+      const int f, w, h;
+      int width () const { return w; }
+      int height () const { return h; }
+      ctype operator() (int x, int y) const { return im (x/f, y/f); }
+    };
+    const Protocol previous = std::exchange (current_protocol, protocol);
+    std::string out;
+    try { out = encode_indexed (Upsampled { reduced, factor, width, height }, cmap, nullptr, { false, image_id }); }
+    catch (...) { current_protocol = previous; throw; }
+    current_protocol = previous;
+
+    std::lock_guard lock (mutex);
+    if (refined != generation)
+      ++ncancelled;
+    ++generation;
+    cancel = true;
+    job.reset();
+    try { write (out); }
+    catch (...) { refined = generation; cond.notify_all(); throw; }
+  }
+
+
+  inline void Progressive::refine (Image<ctype>&& indices, const ColourMap& cmap)
+  {
+    {
+      std::lock_guard lock (mutex);
+      job_cmap = cmap;
+      job.emplace (std::move (indices));
+    }
+    cond.notify_all();
+  }
+
+
+  // give up on refining the latest preview, if its full resolution image
+  // could not be prepared, so that wait() & the destructor do not block:
+  inline void Progressive::abandon ()
+  {
+    {
+      std::lock_guard lock (mutex);
+      refined = generation;
+    }
+    cond.notify_all();
+  }
+
+
+  // background thread: encode the latest full resolution image, and write it
+  // over its preview, unless superseded by a newer image in the meantime:
+  inline void Progressive::run ()
+  {
+    current_protocol = protocol;
+    std::unique_lock lock (mutex);
+    while (true) {
+      cond.wait (lock, [&] { return job || stopping; });
+      if (!job)
+        return;
+
+      const Image<ctype> indices (std::move (*job));
+      const ColourMap cmap (job_cmap);
+      const std::uint64_t current = generation;
+      job.reset();
+      cancel = false;
+      lock.unlock();
+
+      std::string out;
+      std::exception_ptr failure;
+      try { out = encode_indexed (indices, cmap, &cancel, { false, image_id }); }
+      catch (...) { failure = std::current_exception(); }
+
+      lock.lock();
+      if (current != generation)
+        continue;
+      if (!failure) {
+        try { write (out); }
+        catch (...) { failure = std::current_exception(); }
+      }
+      if (failure)
+        error = failure;
+      refined = current;
+      cond.notify_all();
+    }
+  }
+
+
+
+
+  // **************************************************************************
+  //                   dither implementation
+  // **************************************************************************
+
+  namespace {
+
+    // Both dithering methods operate on pixel values of type
+    // std::array<float,C>, provided by `fetch (x, y)`. `quantise (value)`
+    // returns the index of the closest entry in the colourmap, and replaces
+    // `value` with that entry.
+
+    // 8x8 Bayer matrix, also used by TG::overlay:
+    constexpr std::array<std::array<int,8>,8> bayer = {{
+      {  0, 32,  8, 40,  2, 34, 10, 42 },
+      { 48, 16, 56, 24, 50, 18, 58, 26 },
+      { 12, 44,  4, 36, 14, 46,  6, 38 },
+      { 60, 28, 52, 20, 62, 30, 54, 22 },
+      {  3, 35, 11, 43,  1, 33,  9, 41 },
+      { 51, 19, 59, 27, 49, 17, 57, 25 },
+      { 15, 47,  7, 39, 13, 45,  5, 37 },
+      { 63, 31, 55, 23, 61, 29, 53, 21 }
+    }};
+
+    template <int C, class Fetch, class Quantise>
+      inline Image<ctype> ordered_dither (int x_dim, int y_dim, float spread, Fetch&& fetch, Quantise&& quantise)
+      {
+        Image<ctype> indices (x_dim, y_dim);
+        const int nthreads = num_threads (std::size_t (x_dim) * y_dim, 1U<<16);
+        parallel_for (nthreads, 0, y_dim, [&] (int, std::size_t start, std::size_t end) {
+            for (int y = start; y < static_cast<int> (end); ++y) {
+              for (int x = 0; x < x_dim; ++x) {
+                const float offset = spread * ((bayer[y&7][x&7] + 0.5f) / 64.0f - 0.5f);
+                std::array<float,C> value = fetch (x, y);
+                for (auto& v : value)
+                  v += offset;
+                indices(x,y) = quantise (value);
+              }
+            }
+            });
+        return indices;
+      }
+
+
+
+    template <int C, class Fetch, class Quantise>
+      inline Image<ctype> error_diffusion (int x_dim, int y_dim, Fetch&& fetch, Quantise&& quantise)
+      {
+        // Each row can only be processed up to one pixel behind the row
+        // above, since it receives the error diffused from the pixel above
+        // and to the right. Rows are shared out between threads in
+        // round-robin fashion, and processed in blocks of columns; a row
+        // only proceeds with a block once the row above has completed the
+        // next block. `progress` holds the number of blocks completed for
+        // each row.
+        constexpr int block = 64;
+        const int nblocks = (x_dim + block - 1) / block;
+        const int nthreads = std::min (num_threads (std::size_t (x_dim) * y_dim, 1U<<16), y_dim);
+
+        Image<ctype> indices (x_dim, y_dim);
+        // error buffers, padded by one pixel on either side:
+        std::vector<std::array<float,C>> errors (std::size_t (x_dim+2) * (y_dim+1), std::array<float,C> { });
+        std::vector<std::atomic<int>> progress (y_dim);
+        for (auto& p : progress)
+          p.store (0, std::memory_order_relaxed);
+
+        auto process_rows = [&] (int thread) {
+          for (int y = thread; y < y_dim; y += nthreads) {
+            auto* error = errors.data() + std::size_t (x_dim+2) * y + 1;
+            auto* error_below = error + (x_dim+2);
+            std::array<float,C> carry { };
+
+            for (int b = 0; b < nblocks; ++b) {
+              if (y > 0) {
+                const int required = std::min (b+2, nblocks);
+                while (progress[y-1].load (std::memory_order_acquire) < required)
+                  std::this_thread::yield();
+              }
+
+              for (int x = b*block; x < std::min ((b+1)*block, x_dim); ++x) {
+                std::array<float,C> value = fetch (x, y);
+                for (int c = 0; c < C; ++c)
+                  value[c] += error[x][c] + carry[c];
+                const std::array<float,C> original = value;
+                indices(x,y) = quantise (value);
+                for (int c = 0; c < C; ++c) {
+                  const float delta = original[c] - value[c];
+                  carry[c] = delta * (7.0f/16.0f);
+                  error_below[x-1][c] += delta * (3.0f/16.0f);
+                  error_below[x][c] += delta * (5.0f/16.0f);
+                  error_below[x+1][c] += delta * (1.0f/16.0f);
+                }
+              }
+
+              progress[y].store (b+1, std::memory_order_release);
+            }
+          }
+        };
+
+        std::vector<std::thread> threads;
+        for (int n = 1; n < nthreads; ++n)
+          threads.emplace_back (process_rows, n);
+        process_rows (0);
+        for (auto& t : threads)
+          t.join();
+
+        return indices;
+      }
+
+
+
+    template <int C, class Fetch, class Quantise>
+      inline Image<ctype> dither (int x_dim, int y_dim, Dither method, float spread, Fetch&& fetch, Quantise&& quantise)
+      {
+        if (method == Dither::Ordered)
+          return ordered_dither<C> (x_dim, y_dim, spread, fetch, quantise);
+        return error_diffusion<C> (x_dim, y_dim, fetch, quantise);
+      }
+
+  }
+
+
+
+  template <class ImageType>
+    inline Image<ctype> dither (const ImageType& image, double min, double max, int cmap_size, Dither method)
+    {
+      // work in units of colourmap indices. Values are clamped to the range
+      // of the colourmap before any error is added, so that saturated pixels
+      // don't diffuse large errors onto their neighbours:
+      const float scale = (cmap_size-1) / (max - min);
+      auto fetch = [&] (int x, int y) {
+        const float value = scale * (image(x,y) - min);
+        return std::array<float,1> { value > 0.0f ? std::min (value, cmap_size-1.0f) : 0.0f };
+      };
+      auto quantise = [cmap_size] (std::array<float,1>& value) {
+        value[0] = std::round (std::clamp (value[0], 0.0f, cmap_size-1.0f));
+        return ctype (value[0]);
+      };
+      return dither<1> (image.width(), image.height(), method, 1.0f, fetch, quantise);
+    }
+
+
+
+  template <class ImageType>
+    requires std::convertible_to<decltype(std::declval<const ImageType>()(0,0)), RGB>
+    inline Image<ctype> dither (const ImageType& image, const Palette& palette, Dither method)
+    {
+      // colours of palette entries, in the same units as the image:
+      std::vector<std::array<float,3>> colours;
+      for (const auto& c : palette.colourmap())
+        colours.push_back ({ 2.55f*c[0], 2.55f*c[1], 2.55f*c[2] });
+
+      auto fetch = [&] (int x, int y) {
+        const RGB c = image(x,y);
+        return std::array<float,3> { float (c[0]), float (c[1]), float (c[2]) };
+      };
+      auto quantise = [&] (std::array<float,3>& value) {
+        RGB c;
+        for (int i = 0; i < 3; ++i)
+          c[i] = std::round (std::clamp (value[i], 0.0f, 255.0f));
+        const ctype index = palette (c);
+        value = colours[index];
+        return index;
+      };
+
+      // for ordered dithering, use the typical spacing between colours in
+      // the palette, assuming they are evenly distributed:
+      const float spread = 255.0f / std::max (std::cbrt (float (colours.size())) - 1.0f, 1.0f);
+      return dither<3> (image.width(), image.height(), method, spread, fetch, quantise);
+    }
+
+
+
+
 
-  template <class ImageType>
-    inline ctype Rescale<ImageType>::operator() (int x, int y) const {
-      double rescaled = cmap_size * (im(x,y) - min) / (max - min);
-      return std::round (std::min (std::max (rescaled, 0.0), cmap_size-1.0));
-    }
 
 
 
   // **************************************************************************
-  //                   magnify implementation
+  //                   overlay implementation
   // **************************************************************************
 
-  template <class ImageType>
-    inline magnify<ImageType>::magnify (const ImageType& image, int factor) :
-      im (image), factor (factor) { }
-
-  template <class ImageType>
-    inline int magnify<ImageType>::width () const { return im.width() * factor; }
+  template <class ImageType, class LabelType>
+    inline overlay<ImageType,LabelType>::overlay (const ImageType& image, double min, double max,
+        const LabelType& labels, const ColourMap& label_colours, double alpha, int gray_levels) :
+      base (image, min, max, gray_levels),
+      labels (labels),
+      gray_levels (gray_levels),
+      nlabels (label_colours.size()),
+      threshold (std::round (64.0 * std::min (std::max (alpha, 0.0), 1.0))),
+      cmap (gray (gray_levels))
+    {
+      if (image.width() != labels.width() || image.height() != labels.height())
+        throw std::runtime_error (std::format ("dimensions of label image ({}x{}) do not match image ({}x{})",
+              labels.width(), labels.height(), image.width(), image.height()));
+      if (gray_levels + nlabels > 256)
+        throw std::runtime_error (std::format ("too many entries for overlay colourmap ({} gray levels + {} labels > 256)",
+              gray_levels, nlabels));
+      cmap.insert (cmap.end(), label_colours.begin(), label_colours.end());
+    }
 
-  template <class ImageType>
-    inline int magnify<ImageType>::height () const { return im.height() * factor; }
 
-  template <class ImageType>
-    inline decltype(std::declval<const ImageType>()(0,0)) magnify<ImageType>::operator() (int x, int y) const {
-      return im (x/factor, y/factor);
+  template <class ImageType, class LabelType>
+    inline ctype overlay<ImageType,LabelType>::operator() (int x, int y) const
+    {
+      const int label = labels(x,y);
+      if (label > 0 && label <= nlabels && bayer[y&7][x&7] < threshold)
+        return gray_levels + label - 1;
+      return base(x,y);
     }
 
 
 
 
+
+
+
   // **************************************************************************
-  //                   imshow implementation
+  //                   QuantileSketch implementation
   // **************************************************************************
 
+  inline QuantileSketch::QuantileSketch (int k) :
+    k (std::max (k, 8)),
+    n (0),
+    minval (std::numeric_limits<double>::infinity()),
+    maxval (-std::numeric_limits<double>::infinity()),
+    random_state (0x9E3779B97F4A7C15ULL),
+    levels (1),
+    retained (0),
+    total_capacity (capacity (0)) { }
 
 
+  // capacity of each level decreases geometrically (by a factor of 2/3)
+  // from k at the top level, down to a minimum of 8:
+  inline std::size_t QuantileSketch::capacity (std::size_t level) const
+  {
+    const double depth = levels.size() - 1 - level;
+    return std::max (8.0, std::ceil (k * std::pow (2.0/3.0, depth)));
+  }
 
-  // functions in anonymous namespace will remain private to this file:
-  namespace {
-
-    // helper functions for colourmap handling:
 
-    inline std::string colourmap_specifier (const ColourMap& colours)
-    {
-      int n = 0;
-      std::string specifier;
-      for (const auto& c : colours)
-        specifier += std::format ("#{};2;{};{};{}",
-            n++, static_cast<int>(c[0]), static_cast<int>(c[1]),static_cast<int>(c[2]));
-      return specifier;
-    }
+  inline void QuantileSketch::add (double value)
+  {
+    if (std::isnan (value))
+      return;
+    ++n;
+    minval = std::min (minval, value);
+    maxval = std::max (maxval, value);
+    levels[0].push_back (value);
+    if (++retained >= total_capacity)
+      compress();
+  }
 
 
+  inline void QuantileSketch::merge (const QuantileSketch& other)
+  {
+    n += other.n;
+    minval = std::min (minval, other.minval);
+    maxval = std::max (maxval, other.maxval);
+    if (levels.size() < other.levels.size())
+      levels.resize (other.levels.size());
+    for (std::size_t h = 0; h < other.levels.size(); ++h)
+      levels[h].insert (levels[h].end(), other.levels[h].begin(), other.levels[h].end());
+
+    retained += other.retained;
+    total_capacity = 0;
+    for (std::size_t h = 0; h < levels.size(); ++h)
+      total_capacity += capacity (h);
+    compress();
+  }
 
 
-    inline void commit (std::stringstream& out, ctype current, int repeats)
-    {
-      if (repeats <=3) {
-        for (int n = 0; n < repeats; ++n)
-          out.put (63+current);
+  // Compression is lazy: nothing happens until the total number of values
+  // retained exceeds the total capacity. At that point, every other value
+  // (starting at random) of the lowest level that has reached its capacity
+  // is promoted to the level above:
+  inline void QuantileSketch::compress ()
+  {
+    while (retained >= total_capacity) {
+      std::size_t h = 0;
+      while (levels[h].size() < capacity (h))
+        ++h;
+      if (h+1 == levels.size()) {
+        levels.emplace_back();
+        total_capacity = 0;
+        for (std::size_t l = 0; l < levels.size(); ++l)
+          total_capacity += capacity (l);
       }
-      else
-        out << std::format ("!{}{}", repeats, char(63+current));
-    }
 
+      // xorshift64 pseudo-random number generator:
+      random_state ^= random_state << 13;
+      random_state ^= random_state >> 7;
+      random_state ^= random_state << 17;
+
+      auto& values = levels[h];
+      std::ranges::sort (values);
+      const bool odd = values.size() & 1U;
+      const double leftover = values.back();
+      for (std::size_t i = random_state & 1U; i+odd < values.size(); i += 2)
+        levels[h+1].push_back (values[i]);
+      retained -= (values.size() - odd) / 2;
+      values.clear();
+      if (odd)
+        values.push_back (leftover);
+    }
+  }
 
-    template <class ImageType>
-    inline std::string encode_row (const ImageType& im, int y0, int x_dim, int nsixels, const ctype intensity)
-    {
-      int repeats = 0;
-      std::stringstream out;
-      ctype current = std::numeric_limits<ctype>::max();
 
-      for (int x = 0; x < x_dim; ++x) {
-        ctype c = 0;
-        for (int y = 0; y < nsixels; ++y) {
-          if (im(x,y+y0) == intensity)
-            c |= 1U<<y;
-        }
-        if (!repeats) {
-          ++repeats;
-          current = c;
-          continue;
-        }
-        if (c == current) {
-          ++repeats;
-          continue;
+  inline std::vector<double> QuantileSketch::quantile (const std::vector<double>& q) const
+  {
+    // each value at level h stands in for 2^h of the original values:
+    std::vector<std::pair<double,std::size_t>> values;
+    for (std::size_t h = 0; h < levels.size(); ++h)
+      for (const auto v : levels[h])
+        values.emplace_back (v, std::size_t (1) << h);
+    std::ranges::sort (values);
+
+    std::vector<double> result (q.size(), NAN);
+    if (!n)
+      return result;
+
+    for (std::size_t i = 0; i < q.size(); ++i) {
+      if (q[i] <= 0.0) { result[i] = minval; continue; }
+      if (q[i] >= 1.0) { result[i] = maxval; continue; }
+      const double target = q[i] * n;
+      std::size_t cumulative = 0;
+      result[i] = maxval;
+      for (const auto& [ v, weight ] : values) {
+        cumulative += weight;
+        if (cumulative >= target) {
+          result[i] = v;
+          break;
         }
-        commit (out, current, repeats);
-        current = c;
-        repeats = 1;
       }
-      commit (out, current, repeats);
-
-      return out.str();
     }
+    return result;
+  }
 
 
-    template <class ImageType>
-      inline std::string encode (const ImageType& im, int cmap_size, int y0)
-      {
-        std::string out;
-        const int nsixels = std::min (im.height()-y0, 6);
+  inline double QuantileSketch::quantile (double q) const
+  {
+    return quantile (std::vector<double> { q })[0];
+  }
 
-        bool first = true;
-        for (ctype intensity = 0; intensity < cmap_size; ++intensity) {
-          std::string row = encode_row (im, y0, im.width(), nsixels, intensity);
-          if (row.size()) {
-            if (first) first = false;
-            else out += '$';
-            out += std::format ("#{}{}", static_cast<int>(intensity), row);
-          }
-        }
-        out += '-';
-        return out;
-      }
 
-  }
 
+  template <class ValuesType>
+    inline QuantileSketch quantile_sketch (const ValuesType& values, int k)
+    {
+      const int nthreads = num_threads (values.size(), 1U<<16);
+      std::vector<QuantileSketch> sketches (nthreads, QuantileSketch (k));
+      parallel_for (nthreads, 0, values.size(), [&] (int t, std::size_t start, std::size_t end) {
+          for (std::size_t i = start; i < end; ++i)
+            sketches[t].add (values[i]);
+          });
+
+      for (int t = 1; t < nthreads; ++t)
+        sketches[0].merge (sketches[t]);
+      return sketches[0];
+    }
 
 
 
 
 
 
-  template <class ImageType>
-    inline void imshow (const ImageType& image, const ColourMap& cmap)
-    {
-      std::string out = "\033P9q" + colourmap_specifier (cmap);
-      for (int y = 0; y < image.height(); y += 6)
-        out += encode (image, cmap.size(), y);
-      out += "\033\\\n";
-      std::cout.write (out.data(), out.size());
-      std::cout.flush();
-    }
 
+  // **************************************************************************
+  //                   histogram implementation
+  // **************************************************************************
+
+  namespace {
+
+    // range of finite values in the data series supplied:
+    template <class ValuesType>
+      inline std::array<double,2> value_range (const ValuesType& values)
+      {
+        const int nthreads = num_threads (values.size(), 1U<<16);
+        std::vector<std::array<double,2>> ranges (nthreads,
+            { std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity() });
+        parallel_for (nthreads, 0, values.size(), [&] (int n, std::size_t start, std::size_t end) {
+            auto& range = ranges[n];
+            for (std::size_t i = start; i < end; ++i) {
+              const double val = values[i];
+              if (std::isfinite (val)) {
+                range[0] = std::min (range[0], val);
+                range[1] = std::max (range[1], val);
+              }
+            }
+            });
+
+        std::array<double,2> range = ranges[0];
+        for (const auto& r : ranges) {
+          range[0] = std::min (range[0], r[0]);
+          range[1] = std::max (range[1], r[1]);
+        }
+        return range;
+      }
+
+  }
 
 
-  template <class ImageType>
-    inline void imshow (const ImageType& image, double min, double max, const ColourMap& cmap)
+
+  template <class ValuesType>
+    inline std::vector<std::size_t> histogram (const ValuesType& values, double min, double max, int nbins)
     {
-      Rescale<ImageType> rescaled (image, min, max, cmap.size());
-      imshow (rescaled, cmap);
+      if (nbins < 1 || !(max > min))
+        throw std::runtime_error (std::format ("invalid histogram range [ {} {} ] or number of bins ({})", min, max, nbins));
+
+      const double scale = nbins / (max - min);
+      const int nthreads = num_threads (values.size(), 1U<<16);
+
+      // values are processed in blocks: the bin indices for the whole block
+      // are computed first, in a branch-free loop that the compiler can
+      // vectorise, then counted. Values outside the range are assigned to
+      // an additional bin, discarded at the end:
+      constexpr std::size_t block_size = 256;
+      std::vector<std::vector<std::size_t>> histograms (nthreads);
+      parallel_for (nthreads, 0, values.size(), [&] (int n, std::size_t start, std::size_t end) {
+          auto& hist = histograms[n];
+          hist.assign (nbins+1, 0);
+          std::array<int,block_size> index;
+          for (std::size_t block = start; block < end; block += block_size) {
+            const int count = std::min (block_size, end-block);
+            for (int i = 0; i < count; ++i) {
+              const double bin = scale * (values[block+i] - min);
+              index[i] = bin >= 0.0 && bin <= nbins ? std::min (static_cast<int> (bin), nbins-1) : nbins;
+            }
+            for (int i = 0; i < count; ++i)
+              ++hist[index[i]];
+          }
+          });
+
+      auto& hist = histograms[0];
+      for (int n = 1; n < nthreads; ++n)
+        for (int i = 0; i < nbins; ++i)
+          hist[i] += histograms[n][i];
+      hist.pop_back();
+      return std::move (hist);
     }
 
 
@@ -732,7 +4514,6 @@ namespace TG {
 
 
 
-
   // **************************************************************************
   //                   Plot implementation
   // **************************************************************************
@@ -791,8 +4572,12 @@ namespace TG {
 
   inline Plot::~Plot ()
   {
-    if (show_on_destruct)
-      show();
+    // destructors must not throw - call show() explicitly to be notified
+    // of errors writing to the sink:
+    if (show_on_destruct) {
+      try { show(); }
+      catch (...) { }
+    }
   }
 
   inline Plot& Plot::reset ()
@@ -804,7 +4589,7 @@ namespace TG {
     return *this;
   }
 
-  inline Plot& Plot::show()
+  inline Plot& Plot::show (Sink& sink)
   {
     if (std::isfinite (xgrid)) {
       for (float x = xgrid*std::ceil (xlim[0]/xgrid); x < xlim[1]; x += xgrid) {
@@ -827,7 +4612,7 @@ namespace TG {
       }
     }
 
-    imshow (canvas, cmap);
+    imshow (canvas, cmap, sink);
 
     return *this;
   }
@@ -947,7 +4732,7 @@ namespace TG {
 
 
 
-  Plot& Plot::add_text (const std::string& text, float x, float y,
+  inline Plot& Plot::add_text (const std::string& text, float x, float y,
       float anchor_x, float anchor_y, int colour_index)
   {
     auto f = Font::get_font();
@@ -965,6 +4750,307 @@ namespace TG {
 
 
 
+  inline Plot& Plot::add_boxplot (float x, const QuantileSketch& sketch, float width,
+      int colour_index, float whisker)
+  {
+    if (!sketch.count())
+      return *this;
+
+    std::array<float,5> q;
+    std::ranges::copy (sketch.quantile ({ whisker, 0.25, 0.5, 0.75, 1.0-whisker }), q.begin());
+    const float x0 = x - 0.5f*width, x1 = x + 0.5f*width;
+
+    if (!std::isfinite (xlim[0]) || !std::isfinite (xlim[1]))
+      set_xlim (x0, x1, lim_expand_by_factor);
+
+    if (!std::isfinite (ylim[0]) || !std::isfinite (ylim[1]))
+      set_ylim (q[0], q[4], lim_expand_by_factor);
+
+    // box, with median:
+    add_line (x0, q[1], x1, q[1], colour_index);
+    add_line (x0, q[3], x1, q[3], colour_index);
+    add_line (x0, q[2], x1, q[2], colour_index);
+    if (q[1] < q[3]) {
+      add_line (x0, q[1], x0, q[3], colour_index);
+      add_line (x1, q[1], x1, q[3], colour_index);
+    }
+
+    // whiskers:
+    add_line (x-0.25f*width, q[0], x+0.25f*width, q[0], colour_index);
+    add_line (x-0.25f*width, q[4], x+0.25f*width, q[4], colour_index);
+    if (q[0] < q[1])
+      add_line (x, q[0], x, q[1], colour_index);
+    if (q[3] < q[4])
+      add_line (x, q[3], x, q[4], colour_index);
+
+    return *this;
+  }
+
+
+
+  template <class SketchesType>
+    inline Plot& Plot::add_quantile_band (const SketchesType& sketches, float lower, float upper,
+        int colour_index, int median_colour_index)
+    {
+      const std::size_t n = sketches.size();
+      if (n < 2)
+        throw std::runtime_error ("at least 2 distributions are required to plot quantile band");
+
+      std::vector<float> low (n), median (n), high (n);
+      for (std::size_t i = 0; i < n; ++i) {
+        const auto q = sketches[i].quantile ({ lower, 0.5, upper });
+        low[i] = q[0];
+        median[i] = q[1];
+        high[i] = q[2];
+      }
+
+      if (!std::isfinite (xlim[0]) || !std::isfinite (xlim[1]))
+        set_xlim (0, n-1, 0.0);
+
+      std::vector<float> x (n);
+      for (std::size_t i = 0; i < n; ++i)
+        x[i] = i;
+      add_band (x, low, high, colour_index);
+
+      return add_line (median, median_colour_index);
+    }
+
+
+
+  template <class VerticesTypeX, class VerticesTypeY>
+    inline Plot& Plot::add_polygon (const VerticesTypeX& x, const VerticesTypeY& y, int colour_index)
+    {
+      if (x.size() != y.size())
+        throw std::runtime_error ("number of x & y vertices do not match");
+      if (x.size() < 3)
+        return *this;
+
+      if (!std::isfinite (xlim[0]) || !std::isfinite (xlim[1]))
+        set_xlim (std::ranges::min (x), std::ranges::max (x), lim_expand_by_factor);
+
+      if (!std::isfinite (ylim[0]) || !std::isfinite (ylim[1]))
+        set_ylim (std::ranges::min (y), std::ranges::max (y), lim_expand_by_factor);
+
+      std::vector<std::array<float,2>> vertices (x.size());
+      for (std::size_t n = 0; n < x.size(); ++n)
+        vertices[n] = { mapx (x[n]), mapy (y[n]) };
+      fill_polygon (vertices, colour_index);
+
+      return *this;
+    }
+
+
+
+  template <class VerticesTypeX, class VerticesTypeLower, class VerticesTypeUpper>
+    inline Plot& Plot::add_band (const VerticesTypeX& x, const VerticesTypeLower& lower,
+        const VerticesTypeUpper& upper, int colour_index)
+    {
+      const std::size_t n = x.size();
+      if (lower.size() != n || upper.size() != n)
+        throw std::runtime_error ("number of x, lower & upper vertices do not match");
+
+      // trace along the lower boundary, then back along the upper boundary:
+      std::vector<float> vx (2*n), vy (2*n);
+      for (std::size_t i = 0; i < n; ++i) {
+        vx[i] = vx[2*n-1-i] = x[i];
+        vy[i] = lower[i];
+        vy[2*n-1-i] = upper[i];
+      }
+      return add_polygon (vx, vy, colour_index);
+    }
+
+
+
+  template <class ImageType>
+    inline Plot& Plot::add_image (const ImageType& image, float x0, float y0, float x1, float y1,
+        double min, double max, const ColourMap& colourmap)
+    {
+      if (!std::isfinite (xlim[0]) || !std::isfinite (xlim[1]))
+        set_xlim (x0, x1, 0.0);
+
+      if (!std::isfinite (ylim[0]) || !std::isfinite (ylim[1]))
+        set_ylim (y0, y1, 0.0);
+
+      // find colourmap in plot colourmap, or append it:
+      std::size_t offset = 0;
+      while (offset + colourmap.size() <= cmap.size() &&
+          !std::equal (colourmap.begin(), colourmap.end(), cmap.begin()+offset))
+        ++offset;
+      if (offset + colourmap.size() > cmap.size()) {
+        offset = cmap.size();
+        if (offset + colourmap.size() > 256)
+          throw std::runtime_error (std::format ("too many entries in plot colourmap ({} + {} > 256)",
+                cmap.size(), colourmap.size()));
+        cmap.insert (cmap.end(), colourmap.begin(), colourmap.end());
+      }
+
+      // tables of the image column & row for each column & row of pixels
+      // in the plotting area covered by the image:
+      auto resample_table = [] (float start, float end, int size, int limit) {
+        if (start > end)
+          std::swap (start, end);
+        std::vector<int> table;
+        const int first = std::max (0.0f, std::round (start));
+        const int last = std::min (float (limit), std::round (end));
+        for (int p = first; p < last; ++p)
+          table.push_back (std::clamp (static_cast<int> (size * (p + 0.5f - start) / (end - start)), 0, size-1));
+        return std::pair { first, table };
+      };
+      const auto [ px0, columns ] = resample_table (mapx (x0), mapx (x1), image.width(), canvas.width()-margin_x);
+      const auto [ py0, rows ] = resample_table (mapy (y1), mapy (y0), image.height(), canvas.height()-margin_y);
+      if (columns.empty())
+        return *this;
+
+      // compute indices once per image row, reusing them for all rows of
+      // pixels that map onto it:
+      const Rescale<ImageType> rescaled (image, min, max, colourmap.size());
+      std::vector<ctype> indices (columns.size());
+      for (std::size_t n = 0; n < rows.size(); ++n) {
+        if (n == 0 || rows[n] != rows[n-1]) {
+          for (std::size_t i = 0; i < columns.size(); ++i)
+            indices[i] = (i > 0 && columns[i] == columns[i-1]) ?
+              indices[i-1] : offset + rescaled (columns[i], rows[n]);
+        }
+        std::ranges::copy (indices, &canvas(margin_x+px0, py0+n));
+      }
+
+      return *this;
+    }
+
+
+
+  template <class VerticesType>
+    inline Plot& Plot::add_bars (const VerticesType& heights, float x0, float width, int colour_index)
+    {
+      const std::size_t n = heights.size();
+      if (!n)
+        return *this;
+
+      if (!std::isfinite (xlim[0]) || !std::isfinite (xlim[1]))
+        set_xlim (x0, x0 + n*width, 0.0);
+
+      if (!std::isfinite (ylim[0]) || !std::isfinite (ylim[1]))
+        set_ylim (std::min (0.0f, float (std::ranges::min (heights))),
+            std::max (0.0f, float (std::ranges::max (heights))), lim_expand_by_factor);
+
+      // positions are clamped to just beyond the plotting area, so that
+      // values far outside the axis limits remain safe to convert to int,
+      // and never drive more iterations than there are rows:
+      const int plot_width = canvas.width()-margin_x, plot_height = canvas.height()-margin_y;
+      auto clamped = [] (float pos, int size) -> int {
+        return std::round (std::clamp (pos, -1.0f, float (size)));
+      };
+
+      const int baseline = clamped (mapy (0.0), plot_height);
+      for (std::size_t i = 0; i < n; ++i) {
+        const float value = heights[i];
+        if (!std::isfinite (value))
+          continue;
+        const int left = clamped (mapx (x0 + i*width), plot_width);
+        int right = clamped (mapx (x0 + (i+1)*width), plot_width) - 1;
+        // leave a gap between bars if wide enough:
+        if (right - left >= 3)
+          --right;
+        right = std::max (left, right);
+        const int top = clamped (mapy (value), plot_height);
+        for (int y = std::min (top, baseline); y <= std::max (top, baseline); ++y)
+          fill_span (y, left, right, colour_index);
+      }
+
+      return *this;
+    }
+
+
+
+  template <class ValuesType>
+    inline Plot& Plot::add_histogram (const ValuesType& values, float min, float max, int nbins, int colour_index)
+    {
+      return add_bars (histogram (values, min, max, nbins), min, (max-min)/nbins, colour_index);
+    }
+
+
+
+  template <class ValuesType>
+    inline Plot& Plot::add_histogram_auto (const ValuesType& values, int nbins, int colour_index)
+    {
+      auto [ min, max ] = value_range (values);
+      if (!std::isfinite (min))
+        throw std::runtime_error ("no finite values found to compute histogram");
+      if (min == max) {
+        min -= 0.5;
+        max += 0.5;
+      }
+      return add_histogram (values, min, max, nbins, colour_index);
+    }
+
+
+
+  // fill the span of pixels (x0, x1) inclusive along row y, in the
+  // coordinates of the plotting area, clipped to its extent:
+  inline void Plot::fill_span (int y, int x0, int x1, int colour_index)
+  {
+    x0 = std::max (x0, 0);
+    x1 = std::min (x1, canvas.width()-margin_x-1);
+    if (y < 0 || y >= canvas.height()-margin_y || x0 > x1)
+      return;
+    ctype* row = &canvas(margin_x, y);
+    std::fill (row+x0, row+x1+1, ctype (colour_index));
+  }
+
+
+
+  // fill polygon (in the coordinates of the plotting area) by scanline:
+  // each row of pixels is filled between successive pairs of intersections
+  // with the polygon's edges, so that each pixel is written at most once.
+  // Pixels are included if their centre lies within the polygon.
+  inline void Plot::fill_polygon (const std::vector<std::array<float,2>>& vertices, int colour_index)
+  {
+    struct Edge { int ystart; float yend, x, slope; };
+    const int y_dim = canvas.height()-margin_y;
+
+    // edge table, holding all non-horizontal edges sorted by first row:
+    std::vector<Edge> edges;
+    for (std::size_t n = 0; n < vertices.size(); ++n) {
+      auto a = vertices[n];
+      auto b = vertices[(n+1) % vertices.size()];
+      if (a[1] > b[1])
+        std::swap (a, b);
+      if (!(a[1] < b[1]) || !std::isfinite (a[0]+a[1]+b[0]+b[1]))
+        continue;
+      const float slope = (b[0]-a[0]) / (b[1]-a[1]);
+      const float ystart = std::max (std::ceil (a[1]), 0.0f);
+      if (ystart < b[1] && ystart < y_dim)
+        edges.push_back ({ int (ystart), b[1], a[0] + (ystart-a[1])*slope, slope });
+    }
+    std::ranges::sort (edges, {}, &Edge::ystart);
+
+    // active edge table, holding the edges that intersect the current row:
+    std::vector<Edge> active;
+    std::vector<float> crossings;
+    auto next = edges.begin();
+    for (int y = edges.empty() ? y_dim : edges.front().ystart; y < y_dim; ++y) {
+      for (; next != edges.end() && next->ystart == y; ++next)
+        active.push_back (*next);
+      std::erase_if (active, [y] (const Edge& e) { return e.yend <= y; });
+      if (active.empty()) {
+        if (next == edges.end())
+          break;
+        continue;
+      }
+
+      crossings.clear();
+      for (auto& e : active) {
+        crossings.push_back (e.x);
+        e.x += e.slope;
+      }
+      std::ranges::sort (crossings);
+      for (std::size_t i = 0; i+1 < crossings.size(); i += 2)
+        fill_span (y, std::ceil (crossings[i]), std::floor (crossings[i+1]), colour_index);
+    }
+  }
+
+
+
   inline float Plot::mapx (float x) const
   {
     return (canvas.width()-margin_x) * (x-xlim[0])/(xlim[1]-xlim[0]);
@@ -984,6 +5070,136 @@ namespace TG {
 
 
 
+  // **************************************************************************
+  //                   OrthoView implementation
+  // **************************************************************************
+
+  namespace {
+    // gap (in pixels) between planes in orthogonal view:
+    constexpr int orthoview_gap = 4;
+    // axis perpendicular to each plane, in display order (axial, coronal, sagittal):
+    constexpr std::array<int,3> orthoview_axes = { 2, 1, 0 };
+  }
+
+
+  template <class VolumeType>
+    OrthoView (VolumeType&&, double, double, const ColourMap& = gray()) -> OrthoView<held_volume_t<VolumeType>>;
+
+  template <class VolumeType>
+    inline OrthoView<VolumeType>::OrthoView (VolumeType volume, double min, double max, const ColourMap& colourmap) :
+      vol (std::forward<VolumeType> (volume)),
+      min (min), max (max),
+      cmap (colourmap),
+      cursor ({ vol.width()/2, vol.height()/2, vol.depth()/2 }),
+      planes ({
+          Image<ctype> (vol.width(), vol.height()),
+          Image<ctype> (vol.width(), vol.depth()),
+          Image<ctype> (vol.height(), vol.depth()) }),
+      rendered ({ -1, -1, -1 }),
+      offset ({ 0, vol.width() + orthoview_gap, 2*(vol.width() + orthoview_gap) }),
+      canvas (2*(vol.width() + orthoview_gap) + vol.height(), std::max (vol.height(), vol.depth()))
+    {
+      cmap.push_back ({ 100, 100, 0 });
+    }
+
+
+
+  template <class VolumeType>
+    inline OrthoView<VolumeType>& OrthoView<VolumeType>::set_cursor (int x, int y, int z)
+    {
+      if (x < 0 || x >= vol.width() || y < 0 || y >= vol.height() || z < 0 || z >= vol.depth())
+        throw std::runtime_error (std::format ("cursor position [ {} {} {} ] out of range", x, y, z));
+      cursor = { x, y, z };
+      return *this;
+    }
+
+
+
+  template <class VolumeType>
+    inline OrthoView<VolumeType>& OrthoView<VolumeType>::set_crosshair_colour (const std::array<ctype,3>& colour)
+    {
+      cmap.back() = colour;
+      return *this;
+    }
+
+
+
+  template <class VolumeType>
+    inline void OrthoView<VolumeType>::render_plane (int n)
+    {
+      const int axis = orthoview_axes[n];
+      if (rendered[n] == cursor[axis])
+        return;
+
+      slice plane (vol, axis, cursor[axis]);
+      Rescale rescaled (plane, min, max, cmap.size()-1);
+      for (int y = 0; y < plane.height(); ++y)
+        for (int x = 0; x < plane.width(); ++x)
+          planes[n](x,y) = rescaled(x,y);
+
+      rendered[n] = cursor[axis];
+    }
+
+
+
+  template <class VolumeType>
+    inline void OrthoView<VolumeType>::draw_crosshairs (int n)
+    {
+      struct PlaneView {
+        Image<ctype>& canvas;
+        const int x_offset, x_dim, y_dim;
+        const bool transpose;
+        int width () const { return transpose ? y_dim : x_dim; }
+        int height () const { return transpose ? x_dim : y_dim; }
+        ctype& operator() (int x, int y) { return transpose ? canvas(y+x_offset, x) : canvas(x+x_offset,y); }
+      };
+
+      // location of crosshairs within plane, along each of its axes:
+      const int axis = orthoview_axes[n];
+      const int cx = cursor[axis == 0 ? 1 : 0];
+      const int cy = planes[n].height()-1-cursor[axis == 2 ? 1 : 2];
+      const int colour = cmap.size()-1;
+
+      PlaneView horizontal = { canvas, offset[n], planes[n].width(), planes[n].height(), false };
+      Plot::line_x (horizontal, 0, cy, planes[n].width(), cy, colour, 4, 0.5);
+      PlaneView vertical = { canvas, offset[n], planes[n].width(), planes[n].height(), true };
+      Plot::line_x (vertical, 0, cx, planes[n].height(), cx, colour, 4, 0.5);
+    }
+
+
+
+  template <class VolumeType>
+    inline OrthoView<VolumeType>& OrthoView<VolumeType>::show (Sink& sink)
+    {
+      for (int n = 0; n < 3; ++n) {
+        render_plane (n);
+        for (int y = 0; y < planes[n].height(); ++y)
+          for (int x = 0; x < planes[n].width(); ++x)
+            canvas(x+offset[n],y) = planes[n](x,y);
+        draw_crosshairs (n);
+      }
+
+      imshow (canvas, cmap, sink);
+      return *this;
+    }
+
+
+
+  template <class VolumeType>
+    inline void orthoview (const VolumeType& volume, int x, int y, int z,
+        double min, double max, const ColourMap& cmap, Sink& sink)
+    {
+      OrthoView (volume, min, max, cmap).set_cursor (x, y, z).show (sink);
+    }
+
+
+
+
+
+
+
+
+
   // **************************************************************************
   //                   Font imlementation
   // **************************************************************************
@@ -0,0 +1,206 @@
+#include <iostream>
+#include <string>
+#include <thread>
+#include <atomic>
+
+#include <poll.h>
+#include <sys/wait.h>
+#if defined(__APPLE__)
+# include <util.h>
+#else
+# include <pty.h>
+#endif
+
+#include "terminal_graphics.h"
+#include "display_server.h"
+
+
+// Test of TG::DisplayServer & TG::DisplayClient, using a pseudo-terminal as
+// a stand-in for the terminal. Several client processes submit frames
+// concurrently, and the output received on the pty is checked to consist
+// of whole sixel images, never interleaved. The recovery from a client
+// that stalls after claiming a slot is also checked. Compile with:
+//
+//     g++ -std=c++20 -I.. test_display_server.cpp -o test_display_server -lutil -lrt
+//
+// Returns a non-zero exit code on failure.
+
+namespace {
+
+  int failures = 0;
+
+  void check (bool condition, const std::string& message)
+  {
+    std::cerr << (condition ? "  pass: " : "  FAIL: ") << message << "\n";
+    if (!condition)
+      ++failures;
+  }
+
+
+  // accumulate everything written to the pty until stopped:
+  class PtyReader {
+    public:
+      PtyReader (int fd) : fd (fd), thread ([this] { run(); }) { }
+      ~PtyReader () { if (thread.joinable()) stop(); }
+      std::string stop () { done = true; thread.join(); return received; }
+    private:
+      const int fd;
+      std::atomic<bool> done { false };
+      std::string received;
+      std::thread thread;
+
+      void run () {
+        char buffer[65536];
+        while (true) {
+          pollfd p { fd, POLLIN, 0 };
+          if (::poll (&p, 1, 100) <= 0) {
+            if (done)
+              return;
+            continue;
+          }
+          const ssize_t n = ::read (fd, buffer, sizeof (buffer));
+          if (n <= 0)
+            return;
+          received.append (buffer, n);
+        }
+      }
+  };
+
+
+  // count the sixel images in the data, or return -1 if any are incomplete
+  // or interleaved:
+  int count_images (const std::string& data)
+  {
+    int count = 0;
+    for (std::size_t pos = 0; (pos = data.find ("\033P9q", pos)) != std::string::npos; ++count) {
+      const auto end = data.find ("\033\\", pos);
+      const auto next = data.find ("\033P9q", pos+1);
+      if (end == std::string::npos || next < end)
+        return -1;
+      pos = end;
+    }
+    return count;
+  }
+
+
+
+  void test_concurrent_clients (const char* name, int terminal)
+  {
+    std::cerr << "concurrent clients:\n";
+    TG::DisplayServer server (name, 8, 1<<20);
+
+    constexpr int nclients = 4, nframes = 30;
+    for (int n = 0; n < nclients; ++n) {
+      if (::fork() == 0) {
+        TG::DisplayClient client (name);
+        TG::Image<float> image (90 + n, 40);
+        for (int f = 0; f < nframes; ++f) {
+          for (int y = 0; y < image.height(); ++y)
+            for (int x = 0; x < image.width(); ++x)
+              image(x,y) = (x + y + f*n) % 50;
+          // alternate between indexed & pre-encoded frames:
+          if (f % 3) {
+            client.submit (image, 0, 50, TG::gray(), n);
+          }
+          else {
+            TG::BufferSink encoded;
+            TG::imshow (image, 0, 50, TG::gray(), encoded);
+            client.submit (encoded.str(), n);
+          }
+          ::usleep (1000);
+        }
+        ::_exit (0);
+      }
+    }
+
+    TG::FileSink sink (terminal);
+    int displayed = 0;
+    int status, nfailed = 0;
+    for (int remaining = nclients; remaining; ) {
+      displayed += server.update (sink);
+      const pid_t pid = ::waitpid (-1, &status, WNOHANG);
+      if (pid > 0) {
+        --remaining;
+        nfailed += !WIFEXITED (status) || WEXITSTATUS (status);
+      }
+      else
+        ::usleep (500);
+    }
+    displayed += server.update (sink);
+
+    check (nfailed == 0, "all clients ran to completion");
+    check (displayed >= nclients, std::format ("{} frames displayed", displayed));
+  }
+
+
+
+  void test_stalled_client (const char* name)
+  {
+    std::cerr << "stalled client:\n";
+    TG::DisplayServer server (name, 4, 1024, std::chrono::milliseconds (50));
+    TG::DisplayClient client (name);
+    TG::BufferSink sink;
+
+    // claim a slot without ever publishing it, as a client that crashed
+    // would, by accessing the ring buffer directly:
+    const int fd = ::shm_open (name, O_RDWR, 0);
+    struct stat st;
+    ::fstat (fd, &st);
+    auto* ring = static_cast<TG::DisplayRing*> (::mmap (nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+    ::close (fd);
+    ring->enqueue_pos.fetch_add (1);
+
+    check (client.submit ("frame", 0), "frame submitted behind stalled slot");
+    check (server.update (sink) == 0, "frame held back while slot is pending");
+    ::usleep (100000);
+    check (server.update (sink) == 1 && sink.str() == "frame", "frame displayed once slot is abandoned");
+
+    int capacity = 0;
+    while (client.submit ("x", capacity))
+      ++capacity;
+    check (capacity == 3, std::format ("abandoned slot retired ({} slots usable)", capacity));
+    check (server.update (sink) == 3, "frames displayed after retired slot");
+    check (client.submit ("x", 0) && server.update (sink) == 1, "ring buffer still usable");
+
+    ::munmap (ring, st.st_size);
+  }
+
+}
+
+
+
+int main ()
+{
+  const char* name = "/tg_test_display_server";
+
+  int master, slave;
+  if (::openpty (&master, &slave, nullptr, nullptr, nullptr)) {
+    std::cerr << "unable to open pseudo-terminal\n";
+    return 1;
+  }
+  termios attr;
+  ::tcgetattr (slave, &attr);
+  ::cfmakeraw (&attr);
+  ::tcsetattr (slave, TCSANOW, &attr);
+
+  try {
+    // a region left behind by a server that crashed must not prevent a new
+    // server from starting:
+    ::close (::shm_open (name, O_RDWR | O_CREAT, 0600));
+
+    PtyReader reader (master);
+    test_concurrent_clients (name, slave);
+    const std::string received = reader.stop();
+    const int nimages = count_images (received);
+    check (nimages > 0, std::format ("{} images received on terminal, none interleaved", nimages));
+
+    test_stalled_client (name);
+  }
+  catch (std::exception& e) {
+    std::cerr << "ERROR: " << e.what() << "\n";
+    return 1;
+  }
+
+  std::cerr << (failures ? std::format ("{} check(s) failed\n", failures) : "all checks passed\n");
+  return failures != 0;
+}
@@ -0,0 +1,298 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <sstream>
+#include <thread>
+#include <atomic>
+#include <cstdlib>
+
+#include <poll.h>
+#include <sys/mman.h>
+#if defined(__APPLE__)
+# include <util.h>
+#else
+# include <pty.h>
+#endif
+
+#include "terminal_graphics.h"
+
+
+// Test of the kitty graphics protocol backend, using a pseudo-terminal as a
+// stand-in for the terminal. The graphics commands received on the pty are
+// parsed, the pixel data recovered (either from the inline base64 data or
+// from the shared memory object, which is then removed as the terminal
+// would), and compared against the expected image. Compile with:
+//
+//     g++ -std=c++20 -I.. test_kitty.cpp -o test_kitty -lutil -lrt
+//
+// Returns a non-zero exit code on failure.
+
+namespace {
+
+  int failures = 0;
+
+  void check (bool condition, const std::string& message)
+  {
+    std::cerr << (condition ? "  pass: " : "  FAIL: ") << message << "\n";
+    if (!condition)
+      ++failures;
+  }
+
+
+  // a single image received by the terminal:
+  struct Received {
+    std::map<std::string,std::string> keys;
+    std::vector<unsigned char> rgb;
+
+    std::string operator[] (const std::string& key) const {
+      const auto entry = keys.find (key);
+      return entry == keys.end() ? std::string() : entry->second;
+    }
+  };
+
+
+  std::vector<unsigned char> base64_decode (const std::string& data)
+  {
+    std::vector<unsigned char> out;
+    std::uint32_t value = 0;
+    int bits = 0;
+    for (const char c : data) {
+      const auto digit = std::string_view ("ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/").find (c);
+      if (digit == std::string_view::npos)
+        continue;
+      value = value<<6 | digit;
+      bits += 6;
+      if (bits >= 8) {
+        bits -= 8;
+        out.push_back ((value >> bits) & 0xFFU);
+      }
+    }
+    return out;
+  }
+
+
+  // parse the graphics commands (APC sequences) in the data received, and
+  // recover the image transmitted by each:
+  std::vector<Received> parse (const std::string& data)
+  {
+    std::vector<Received> images;
+    Received current;
+    std::string payload;
+    for (std::size_t pos = 0; (pos = data.find ("\033_G", pos)) != std::string::npos; ) {
+      const auto end = data.find ("\033\\", pos);
+      const auto separator = data.find (';', pos);
+      if (end == std::string::npos || separator > end)
+        break;
+
+      std::map<std::string,std::string> keys;
+      std::stringstream control (data.substr (pos+3, separator-pos-3));
+      for (std::string item; std::getline (control, item, ','); ) {
+        const auto equals = item.find ('=');
+        keys[item.substr (0, equals)] = item.substr (equals+1);
+      }
+      // the first chunk holds all the keys; subsequent chunks only `m`:
+      if (keys.count ("a")) {
+        current = { keys, { } };
+        payload.clear();
+      }
+      payload.append (data, separator+1, end-separator-1);
+
+      if (keys["m"] != "1") {
+        if (current["t"] == "s") {
+          const auto decoded = base64_decode (payload);
+          const std::string name (decoded.begin(), decoded.end());
+          const std::size_t size = std::stoul (current["S"]);
+          const int fd = ::shm_open (name.c_str(), O_RDONLY, 0);
+          if (fd >= 0) {
+            void* mapping = ::mmap (nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+            ::close (fd);
+            if (mapping != MAP_FAILED) {
+              const auto* p = static_cast<const unsigned char*> (mapping);
+              current.rgb.assign (p, p+size);
+              ::munmap (mapping, size);
+            }
+            ::shm_unlink (name.c_str());
+          }
+        }
+        else
+          current.rgb = base64_decode (payload);
+        images.push_back (current);
+      }
+      pos = end;
+    }
+    return images;
+  }
+
+
+  // the RGB data expected for the indexed image displayed with `cmap`:
+  template <class ImageType>
+    std::vector<unsigned char> expected_rgb (const ImageType& image, const TG::ColourMap& cmap)
+    {
+      std::vector<unsigned char> rgb;
+      for (int y = 0; y < image.height(); ++y)
+        for (int x = 0; x < image.width(); ++x)
+          for (const auto c : cmap[image(x,y)])
+            rgb.push_back ((std::min (int (c), 100) * 255 + 50) / 100);
+      return rgb;
+    }
+
+
+  // accumulate everything written to the pty, until collect() is called:
+  class Terminal {
+    public:
+      Terminal () {
+        if (::openpty (&master, &slave, nullptr, nullptr, nullptr))
+          throw std::runtime_error ("unable to open pseudo-terminal");
+        termios attr;
+        ::tcgetattr (slave, &attr);
+        ::cfmakeraw (&attr);
+        ::tcsetattr (slave, TCSANOW, &attr);
+        reader = std::thread ([this] { run(); });
+      }
+      ~Terminal () { if (reader.joinable()) collect(); }
+
+      int fd () const { return slave; }
+
+      std::vector<Received> collect () {
+        done = true;
+        reader.join();
+        return parse (received);
+      }
+
+    private:
+      int master, slave;
+      std::atomic<bool> done { false };
+      std::string received;
+      std::thread reader;
+
+      void run () {
+        char buffer[65536];
+        while (true) {
+          pollfd p { master, POLLIN, 0 };
+          if (::poll (&p, 1, 200) <= 0) {
+            if (done)
+              return;
+            continue;
+          }
+          const ssize_t n = ::read (master, buffer, sizeof (buffer));
+          if (n <= 0)
+            return;
+          received.append (buffer, n);
+        }
+      }
+  };
+
+}
+
+
+
+int main ()
+{
+  // identify the terminal as kitty, so that shared memory may be used:
+  ::setenv ("KITTY_WINDOW_ID", "1", 1);
+  ::unsetenv ("SSH_CONNECTION");
+  ::unsetenv ("SSH_CLIENT");
+  ::unsetenv ("SSH_TTY");
+
+  try {
+    TG::Image<float> image (301, 123);
+    for (int y = 0; y < image.height(); ++y)
+      for (int x = 0; x < image.width(); ++x)
+        image(x,y) = (3*x + y) % 101;
+    const auto expected = expected_rgb (TG::Rescale (image, 0, 100, TG::hot().size()), TG::hot());
+
+    std::cerr << "transfer modes:\n";
+    {
+      Terminal terminal;
+      TG::FileSink sink (terminal.fd());
+      TG::BufferSink buffer;
+      TG::set_protocol (TG::Protocol::Kitty);
+      TG::imshow (image, 0, 100, TG::hot(), sink);
+      TG::imshow (image, 0, 100, TG::hot(), buffer);
+      TG::set_protocol (TG::Protocol::KittyDirect);
+      TG::imshow (image, 0, 100, TG::hot(), sink);
+      sink.write (buffer.str());
+
+      const auto received = terminal.collect();
+      check (received.size() == 3, std::format ("{} images received", received.size()));
+      if (received.size() == 3) {
+        check (received[0]["t"] == "s" && received[0].rgb == expected, "shared memory transfer to terminal");
+        check (received[1]["t"] == "" && received[1].rgb == expected, "direct transfer with KittyDirect");
+        check (received[2]["t"] == "" && received[2].rgb == expected, "direct transfer when not writing to terminal");
+      }
+    }
+
+    std::cerr << "in-place display:\n";
+    {
+      Terminal terminal;
+      TG::FileSink sink (terminal.fd());
+      TG::set_protocol (TG::Protocol::KittyDirect);
+      TG::imshow (image, 0, 100, TG::hot(), sink);
+      for (int n = 0; n < 2; ++n) {
+        TG::InPlace in_place (false, sink);
+        for (int frame = 0; frame < 3; ++frame)
+          TG::imshow (image, 0, 100 + frame, TG::hot(), sink);
+      }
+
+      const auto received = terminal.collect();
+      check (received.size() == 7, std::format ("{} images received", received.size()));
+      if (received.size() == 7) {
+        check (received[0]["i"] == "", "no image ID outside of in-place display");
+        check (received[1]["i"].size() && received[1]["p"] == "1", "in-place images have an image & placement ID");
+        check (received[2]["i"] == received[1]["i"] && received[3]["i"] == received[1]["i"],
+            "successive frames replace the same image");
+        check (received[4]["i"] != received[1]["i"] && received[5]["i"] == received[4]["i"],
+            "different in-place displays use different images");
+      }
+    }
+
+    std::cerr << "nested in-place display:\n";
+    {
+      Terminal terminal;
+      TG::FileSink sink (terminal.fd());
+      TG::set_protocol (TG::Protocol::KittyDirect);
+      {
+        TG::InPlace in_place (false, sink);
+        TG::imshow (image, 0, 100, TG::hot(), sink);
+        {
+          TG::InPlace nested (false, sink);
+          TG::imshow (image, 0, 101, TG::hot(), sink);
+        }
+        TG::imshow (image, 0, 102, TG::hot(), sink);
+      }
+
+      const auto received = terminal.collect();
+      check (received.size() == 3, std::format ("{} images received", received.size()));
+      if (received.size() == 3)
+        check (received[1]["i"] == received[0]["i"] && received[2]["i"] == received[0]["i"],
+            "nested display replaces the same image");
+    }
+
+    std::cerr << "progressive display:\n";
+    {
+      Terminal terminal;
+      TG::FileSink sink (terminal.fd());
+      TG::set_protocol (TG::Protocol::Kitty);
+      {
+        TG::Progressive display (4, 16, false, sink);
+        display.show (image, 0, 100, TG::hot());
+        display.wait();
+      }
+      const auto received = terminal.collect();
+      check (received.size() == 2, std::format ("{} images received", received.size()));
+      if (received.size() == 2) {
+        check (received[0]["t"] == "" && received[1]["t"] == "", "progressive display never uses shared memory");
+        check (received[1]["i"].size() && received[0]["i"] == received[1]["i"], "refinement replaces preview");
+        check (received[1].rgb == expected, "refined image matches");
+      }
+    }
+  }
+  catch (std::exception& e) {
+    std::cerr << "ERROR: " << e.what() << "\n";
+    return 1;
+  }
+
+  std::cerr << (failures ? std::format ("{} check(s) failed\n", failures) : "all checks passed\n");
+  return failures != 0;
+}